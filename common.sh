@@ -1 +1 @@
-echo "-DGBI_PREFIX=F3DEX2 -DVFILE_VISIBILITY=static -DNDEBUG -Wno-unused-function -Wno-unused-variable -Wall -flto -lm -Os -s -flto -Igfxasm/src -Iwowlib -DWOW_OVERLOAD_FILE src/*.c gfxasm/src/*.c -Isrc -lm "
+echo "-DGBI_PREFIX=F3DEX2 -DVFILE_VISIBILITY=static -DNDEBUG -Wno-unused-function -Wno-unused-variable -Wall -flto -lm -Os -s -flto -fopenmp -Igfxasm/src -Iwowlib -DWOW_OVERLOAD_FILE src/*.c gfxasm/src/*.c -Isrc -lm "
@@ -19,6 +19,37 @@ static inline void showargs(void)
 	fprintf(stderr, " --silent               * print only errors\n");
 	//fprintf(stderr, " --docs                 * print old docs format\n"); // TODO this feature
 	fprintf(stderr, " --print-palettes       * output palette addresses\n");
+	fprintf(stderr, " --dither               * dither color-indexed textures\n");
+	fprintf(stderr, "                          - per texture: 'dither none|diffuse'\n");
+	fprintf(stderr, " --merge-palettes       * remap indices so palettes can share data\n");
+	fprintf(stderr, " --auto-palettes  0.0   * share palettes between ci textures\n");
+	fprintf(stderr, "                          - max rms color error (0 = lossless)\n");
+	fprintf(stderr, " --auto-format   40.0   * pick formats for textures without one\n");
+	fprintf(stderr, "                          - min psnr (dB); smallest tmem wins\n");
+	fprintf(stderr, " --atlas                * load small same-format textures together\n");
+	fprintf(stderr, " --max-memory   256     * texture memory budget (MiB)\n");
+	fprintf(stderr, "                          - converts early, spills to disk\n");
+	fprintf(stderr, " --reorder-triangles    * reorder triangles for fewer vertex loads\n");
+	fprintf(stderr, "                          - prints vertices per triangle\n");
+	fprintf(stderr, " --auto-standalone      * call materials only where it saves space\n");
+	fprintf(stderr, "                          - prints materials inlined\n");
+	fprintf(stderr, " --order-materials      * order materials for fewer texture loads\n");
+	fprintf(stderr, "                          - prints estimated rdp cycles saved\n");
+	fprintf(stderr, " --resident-vertices    * keep loaded vertices across flushes\n");
+	fprintf(stderr, " --ucode    f3dex2      * microcode to write display lists for\n");
+	fprintf(stderr, "                          - f3dex2, f3dzex, f3dex3 (56 vertices, strips)\n");
+	fprintf(stderr, " --pool-vertices        * write each distinct vertex run once per file\n");
+	fprintf(stderr, "                          - prints vertex bytes shared\n");
+	fprintf(stderr, " --pool-dlists          * write each distinct display list once per file\n");
+	fprintf(stderr, "                          - prints display lists shared\n");
+	fprintf(stderr, " --flatten-branches     * shorten branch chains, make trailing calls branches\n");
+	fprintf(stderr, "                          - prints branches shortened and nesting depth\n");
+	fprintf(stderr, " --peephole             * drop display list commands that change nothing\n");
+	fprintf(stderr, "                          - prints commands removed\n");
+	fprintf(stderr, " --delta-materials      * run only material state that changes\n");
+	fprintf(stderr, "                          - prints material calls reduced\n");
+	fprintf(stderr, " --batch-limbs          * batch skinned vertices for fewer matrix loads\n");
+	fprintf(stderr, "                          - prints matrix loads written\n");
 	fprintf(stderr, " --no-prefixes          * don't write variable name prefixes\n");
 	fprintf(stderr, "                          - e.g. gEnWhoopee_DlFlap -> Flap\n");
 	fprintf(stderr, " --world-header 'x,y,z' * embed minimal game world headers\n");
@@ -45,6 +45,15 @@ void document_assign(const char* textA, const char* textB, unsigned int offset,
 	}
 }
 
+void document_move(unsigned int offset, unsigned int to, doctype_t type) {
+	for (document_t* doc = sDocumentHead; doc; doc = doc->next) {
+		if ((doc->type & 0xF) != type || (doc->type & (DOC_INT | DOC_ENUM)))
+			continue;
+		if (doc->offset == offset)
+			doc->offset = to;
+	}
+}
+
 void document_free(void) {
 	document_t* doc;
 	
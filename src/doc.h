@@ -29,6 +29,7 @@ typedef enum {
 
 void document_setFileName(const char* file);
 void document_assign(const char* textA, const char* textB, unsigned int offset, doctype_t type);
+void document_move(unsigned int offset, unsigned int to, doctype_t type);
 void document_free();
 
 void document_mergeDefineHeader(FILE* file);
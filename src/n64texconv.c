@@ -846,6 +846,86 @@ n64texconv_to_n64(
 }
 
 
+const char *
+n64texconv_gray_to_n64(
+	unsigned char *dst
+	, unsigned char *pix
+	, int channels
+	, enum n64texconv_fmt fmt
+	, enum n64texconv_bpp bpp
+	, int w
+	, int h
+	, unsigned int *sz
+)
+{
+	void (*n64_colorfunc)(struct vec4b_2n64 *color, unsigned char *b);
+	unsigned int sz_unused;
+	int is_4bit = (bpp == N64TEXCONV_4);
+	int i;
+	
+	/* no src/dst buffers defined */
+	if (!dst || !pix)
+		return "no buffer";
+	
+	/* sz */
+	if (!sz)
+		sz = &sz_unused;
+	
+	/* only intensity formats can be made from gray alone */
+	if ((fmt != N64TEXCONV_I && fmt != N64TEXCONV_IA)
+		|| bpp > N64TEXCONV_16
+		|| !(n64_colorfunc = n64_colorfunc_array_to[fmt * 4 + bpp])
+	)
+		return "invalid format";
+	
+	/* one byte gray, or two bytes gray + alpha */
+	if (channels != 1 && channels != 2)
+		return "invalid channel count";
+	
+	/* invalid dimensions (are <= 0) */
+	if (w <= 0 || h <= 0)
+		return "invalid dimensions (<= 0)";
+	
+	/* the result is never wider than the input (16bpp output needs *
+	 * gray + alpha), so converting in-place front to back is safe   */
+	if (bpp == N64TEXCONV_16 && channels != 2)
+		return "16-bit output requires gray + alpha input";
+	
+	/* determine resulting size */
+	*sz = get_size_bytes(w, h, 0, bpp);
+	
+	for (i = 0; i < w * h; ++i, pix += channels)
+	{
+		struct vec4b_2n64 color;
+		unsigned char c;
+		
+		/* the same pixel n64texconv_to_n64 would have seen */
+		color.x = color.y = color.z = pix[0];
+		color.w = (channels == 2) ? pix[1] : 255;
+		
+		/* 4bpp */
+		if (is_4bit)
+		{
+			n64_colorfunc(&color, &c);
+			if (!(i & 1))
+				*dst = c << 4;
+			else
+				*dst++ |= c & 15;
+		}
+		
+		/* 8bpp and 16bpp */
+		else
+		{
+			n64_colorfunc(&color, dst);
+			dst += bpp;
+		}
+	}
+	
+	/* success */
+	return 0;
+}
+
+
 const char *
 n64texconv_to_n64_and_back(
 	unsigned char *pix
@@ -909,6 +989,7 @@ struct n64texconv_palctx
 	int            n_colors;  /* max colors */
 	int            n_alpha;   /* num alpha colors */
 	void          *colors;    /* where colors end up stored (rgba32) */
+	unsigned short *nearest;  /* nearest color lookup, for dithering */
 	struct pqueue *queue;     /* teimagexture queue */
 };
 
@@ -1132,93 +1213,126 @@ list_colors(oct_node root)
 }
 #endif
 
+/* nearest palette color lookup, indexed by rgb555 */
+#define NEAREST_LUT_NUM  (32 * 32 * 32)
+#define NEAREST_LUT_NONE 0xFFFF
+
 static
-void
-error_diffuse(
-	struct n64texconv_palctx *ctx
-	, unsigned char *srcdst
-	, int w
-	, int h
-	, node_heap *hp
-)
+oct_node
+nearest_color(struct n64texconv_palctx *ctx, const int *v)
 {
-	/* TODO alpha channel */
-	oct_node nearest_color(int *v) {
+	node_heap *hp = &ctx->heap;
+	unsigned short *lut = ctx->nearest;
+	int idx = ((v[0] >> 3) << 10) | ((v[1] >> 3) << 5) | (v[2] >> 3);
+	
+	/* first visit to this cell: search the palette, using the
+	 * center of the cell as the color being matched; palettes
+	 * are rgba5551 anyway, so finer resolution buys nothing
+	 */
+	if (lut[idx] == NEAREST_LUT_NONE)
+	{
+		int r = (v[0] & ~7) | 4;
+		int g = (v[1] & ~7) | 4;
+		int b = (v[2] & ~7) | 4;
 		int i;
 		int diff, max = 100000000;
-		oct_node o = 0;
+		
 		for (i = 1; i < hp->n; i++) {
-			diff =	  3 * abs(hp->buf[i]->r - v[0])
-				+ 5 * abs(hp->buf[i]->g - v[1])
-				+ 2 * abs(hp->buf[i]->b - v[2]);
+			diff =	  3 * abs(hp->buf[i]->r - r)
+				+ 5 * abs(hp->buf[i]->g - g)
+				+ 2 * abs(hp->buf[i]->b - b);
 			if (diff < max) {
 				max = diff;
-				o = hp->buf[i];
+				lut[idx] = i;
 			}
 		}
-		return o;
 	}
+	
+	return hp->buf[lut[idx]];
+}
 
-#	define POS(i, j) (3 * ((i) * w + (j)))
-	int i, j;
-	int *npx = ctx->calloc(sizeof(int), h * w * 3), *px;
-	int v[3];
+static
+void
+error_diffuse(
+	struct n64texconv_palctx *ctx
+	, unsigned char *srcdst
+	, int w
+	, int h
+)
+{
+#define C10 7 /* right */
+#define C01 5 /* below */
+#define C11 2 /* below right */
+#define C00 1 /* below left */
+#define CTOTAL (C00 + C11 + C10 + C01)
+#define clamp(x, i) if (x[i] > 255) x[i] = 255; if (x[i] < 0) x[i] = 0
+	/* error accumulated for the current and next rows; each row
+	 * is padded by one pixel on either side, so error spread past
+	 * the left or right edge lands there and is discarded
+	 */
+	int *err = ctx->calloc(sizeof(int), (w + 2) * 3 * 2);
+	int *cur = err + 3;
+	int *next = err + (w + 2) * 3 + 3;
+	int *swap;
 	unsigned char *pix = srcdst;
+	int i, j, k;
 	oct_node nd;
-
-#define C10 7
-#define C01 5
-#define C11 2
-#define C00 1 
-#define CTOTAL (C00 + C11 + C10 + C01)
-
-	for (px = npx, i = 0; i < h; i++) {
-		for (j = 0; j < w; j++, pix += 3, px += 3) {
-			px[0] = (int)pix[0] * CTOTAL;
-			px[1] = (int)pix[1] * CTOTAL;
-			px[2] = (int)pix[2] * CTOTAL;
-		}
+	
+	if (!ctx->nearest)
+	{
+		ctx->nearest = ctx->calloc(NEAREST_LUT_NUM, sizeof(*ctx->nearest));
+		memset(ctx->nearest, 0xFF, NEAREST_LUT_NUM * sizeof(*ctx->nearest));
 	}
-#define clamp(x, i) if (x[i] > 255) x[i] = 255; if (x[i] < 0) x[i] = 0
-	pix = srcdst;
-	for (px = npx, i = 0; i < h; i++) {
-		for (j = 0; j < w; j++, pix += 3, px += 3) {
-			px[0] /= CTOTAL;
-			px[1] /= CTOTAL;
-			px[2] /= CTOTAL;
-			clamp(px, 0); clamp(px, 1); clamp(px, 2);
-
-			nd = nearest_color(px);
-
-			v[0] = px[0] - nd->r;
-			v[1] = px[1] - nd->g;
-			v[2] = px[2] - nd->b;
-
-			pix[0] = nd->r; pix[1] = nd->g; pix[2] = nd->b;
-			if (j < w - 1) {
-				npx[POS(i, j+1) + 0] += v[0] * C10;
-				npx[POS(i, j+1) + 1] += v[1] * C10;
-				npx[POS(i, j+1) + 2] += v[2] * C10;
+	
+	for (i = 0; i < h; i++) {
+		for (j = 0; j < w; j++, pix += 4) {
+			int *e = cur + j * 3;
+			int v[3];
+			int d[3];
+			
+			/* invisible pixels get their plain palette color and
+			 * neither receive nor spread error; this way, they
+			 * keep the handful of colors acgen gave them
+			 */
+			if (!pix[3]) {
+				color_replace(ctx->root, pix);
+				continue;
 			}
-			if (i >= h - 1) continue;
-
-			npx[POS(i+1, j) + 0] += v[0] * C01;
-			npx[POS(i+1, j) + 1] += v[1] * C01;
-			npx[POS(i+1, j) + 2] += v[2] * C01;
-
-			if (j < w - 1) {
-				npx[POS(i+1, j+1) + 0] += v[0] * C11;
-				npx[POS(i+1, j+1) + 1] += v[1] * C11;
-				npx[POS(i+1, j+1) + 2] += v[2] * C11;
+			
+			for (k = 0; k < 3; k++) {
+				v[k] = pix[k] + e[k] / CTOTAL;
+				clamp(v, k);
 			}
-			if (j) {
-				npx[POS(i+1, j-1) + 0] += v[0] * C00;
-				npx[POS(i+1, j-1) + 1] += v[1] * C00;
-				npx[POS(i+1, j-1) + 2] += v[2] * C00;
+			
+			nd = nearest_color(ctx, v);
+			
+			/* translucent pixels spread proportionally less error */
+			d[0] = (v[0] - nd->r) * pix[3] / 255;
+			d[1] = (v[1] - nd->g) * pix[3] / 255;
+			d[2] = (v[2] - nd->b) * pix[3] / 255;
+			
+			pix[0] = nd->r; pix[1] = nd->g; pix[2] = nd->b;
+			for (k = 0; k < 3; k++) {
+				e[3 + k] += d[k] * C10;
+				next[(j - 1) * 3 + k] += d[k] * C00;
+				next[(j + 0) * 3 + k] += d[k] * C01;
+				next[(j + 1) * 3 + k] += d[k] * C11;
 			}
 		}
+		
+		/* advance to next row */
+		swap = cur;
+		cur = next;
+		next = swap;
+		memset(next - 3, 0, sizeof(int) * (w + 2) * 3);
 	}
-	ctx->free(npx);
+	ctx->free(err);
+#undef C10
+#undef C01
+#undef C11
+#undef C00
+#undef CTOTAL
+#undef clamp
 }
 
 static
@@ -1237,7 +1351,7 @@ palette_apply(
 	assert(h > 0);
 
 	if (dither)
-		error_diffuse(ctx, pix, w, h, &ctx->heap);
+		error_diffuse(ctx, pix, w, h);
 	
 	else
 	{
@@ -1267,7 +1381,7 @@ color_quant(
 	struct n64texconv_palctx *ctx;
 	
 	ctx = n64texconv_palette_new(n_colors, 0, calloc, realloc, free);
-	n64texconv_palette_queue(ctx, srcdst, w, h, 0);
+	n64texconv_palette_queue(ctx, srcdst, w, h, dither);
 	n64texconv_palette_exec(ctx);
 	n64texconv_palette_free(ctx);
 }
@@ -1293,7 +1407,7 @@ n64texconv_palette_ify(
 	int num_colors;
 	
 	ctx = n64texconv_palette_new(n_colors, palette, calloc, realloc, free);
-	n64texconv_palette_queue(ctx, srcdst, w, h, 0);
+	n64texconv_palette_queue(ctx, srcdst, w, h, dither);
 	num_colors = n64texconv_palette_exec(ctx);
 	n64texconv_palette_free(ctx);
 	return num_colors;
@@ -1489,6 +1603,8 @@ n64texconv_palette_free(struct n64texconv_palctx *ctx)
 	
 	node_free(ctx);
 	ctx->free(ctx->heap.buf);
+	if (ctx->nearest)
+		ctx->free(ctx->nearest);
 	
 	ctx->free(ctx);
 }
@@ -1559,68 +1675,120 @@ acfunc_white(ACFUNC_ARGS)
 	return 1;
 }
 
-/* https://github.com/ruozhichen/rgb2Lab-rgb2hsl/blob/master/LAB.py */
+/* lookup tables for rgb2lab */
+#define LAB_CBRT_NUM 4096   /* cube root samples                */
+#define LAB_CBRT_MAX 1.0625 /* normalized X, Y, Z stay below it */
+static double lab_xyz[3][256][3];          /* channel value -> XYZ */
+static double lab_cbrt[LAB_CBRT_NUM + 1];  /* f(t) for t > T1      */
+
 static
-double *
-rgb2lab(unsigned char rgb[3])
+void
+lab_tables_init(void)
 {
-	static double LAB[3];
-	double RGB[3];
-	double XYZ[3];
-	double L = 0;
-	int i;
-	
-	for (i = 0; i < 3; ++i)
-	{
-		RGB[i] = rgb[i];
-		RGB[i] /= 255.0f;
-	}
+	/* reached from threads converting textures at once; atomic
+	 * seq_cst access keeps the table stores ahead of done = 1
+	 */
+	static int done = 0;
+	int isDone;
 	
-	XYZ[0] = RGB[0]*0.4124+RGB[1]*0.3576+RGB[2]*0.1805;
-	XYZ[1] = RGB[0]*0.2126+RGB[1]*0.7152+RGB[2]*0.0722;
-	XYZ[2] = RGB[0]*0.0193+RGB[1]*0.1192+RGB[2]*0.9505;
-	
-	XYZ[0]/=95.045/100.0;
-	XYZ[1]/=100.0/100.0;
-	XYZ[2]/=108.875/100.0;
+	#pragma omp atomic read seq_cst
+	isDone = done;
+	if (isDone)
+		return;
 	
-	for (i = 0; i < 3; ++i)
+	#pragma omp critical (n64texconv_lab_tables)
 	{
-		double v = XYZ[i];
-		
-		if (v > 0.008856)
-		{
-			v = pow(v, 1.0/3.0);
-			if (i == 1)
-				L = 116.0 * v - 16.0;
-		}
-		else
+		#pragma omp atomic read seq_cst
+		isDone = done;
+		if (!isDone)
 		{
-			v *= 7.787;
-			v += 16.0 / 116.0;
-			if (i == 1)
-				L = 903.3 * XYZ[i];
+			/* rgb2lab treats channels as linear, so converting to
+			 * linear is the normalization, folded into the matrix
+			 */
+			static const double m[3][3] = {
+				{ 0.4124, 0.3576, 0.1805 }
+				, { 0.2126, 0.7152, 0.0722 }
+				, { 0.0193, 0.1192, 0.9505 }
+			};
+			int i, c, k;
+			
+			for (c = 0; c < 3; ++c)
+			{
+				for (i = 0; i < 256; ++i)
+				{
+					double v = i;
+					v /= 255.0f;
+					for (k = 0; k < 3; ++k)
+						lab_xyz[c][i][k] = v * m[k][c];
+				}
+			}
+			
+			for (i = 0; i <= LAB_CBRT_NUM; ++i)
+				lab_cbrt[i] = cbrt(i * (LAB_CBRT_MAX / LAB_CBRT_NUM));
+			
+			#pragma omp atomic write seq_cst
+			done = 1;
 		}
-		
-		XYZ[i] = v;
 	}
+}
+
+/* f(t) of the Lab conversion, using the tables */
+static
+inline
+double
+lab_f(double v)
+{
+	double x;
+	double y;
+	int i;
 	
-	double a = 500.0 * (XYZ[0] - XYZ[1]);
-	double b = 200.0 * (XYZ[1] - XYZ[2]);
+	if (v <= 0.008856)
+		return v * 7.787 + 16.0 / 116.0;
 	
-	LAB[0] = L;
-	LAB[1] = a;
-	LAB[2] = b;
+	/* interpolate the cube root, then one newton step
+	 * brings it to (nearly) full double precision
+	 */
+	x = v * (LAB_CBRT_NUM / LAB_CBRT_MAX);
+	i = x;
+	y = lab_cbrt[i] + (lab_cbrt[i + 1] - lab_cbrt[i]) * (x - i);
 	
-	return LAB;
+	return y - (y * y * y - v) / (3.0 * y * y);
+}
+
+/* https://github.com/ruozhichen/rgb2Lab-rgb2hsl/blob/master/LAB.py */
+/* NOTE call lab_tables_init() first */
+static
+inline
+void
+rgb2lab(const unsigned char rgb[3], double lab[3])
+{
+	const double *r = lab_xyz[0][rgb[0]];
+	const double *g = lab_xyz[1][rgb[1]];
+	const double *b = lab_xyz[2][rgb[2]];
+	double X = r[0] + g[0] + b[0];
+	double Y = r[1] + g[1] + b[1];
+	double Z = r[2] + g[2] + b[2];
+	double fX;
+	double fY;
+	double fZ;
+	
+	X /= 95.045 / 100.0;
+	Z /= 108.875 / 100.0;
+	
+	fX = lab_f(X);
+	fY = lab_f(Y);
+	fZ = lab_f(Z);
+	
+	lab[0] = (Y > 0.008856) ? 116.0 * fY - 16.0 : 903.3 * Y;
+	lab[1] = 500.0 * (fX - fY);
+	lab[2] = 200.0 * (fY - fZ);
 }
 
 /* https://github.com/ruozhichen/rgb2Lab-rgb2hsl/blob/master/LAB.py */
 static
 unsigned char *
-lab2rgb(double lab[3])
+lab2rgb(double lab[3], unsigned char rgb[3])
 {
-	static unsigned char rgb[3];
 	double L = lab[0];
 	double a = lab[1];
 	double b = lab[2];
@@ -1680,34 +1848,42 @@ int
 acfunc_average(ACFUNC_ARGS)
 {
 	unsigned char *pix = rgba8888;
-	unsigned int i;
 	unsigned int found = 0;
 	double lab[3] = {0};
+	double L = 0;
+	double A = 0;
+	double B = 0;
 	uint32_t alpha = 0;
+	int n = w * h;
 	
-	/* derive average color of visible pixels */
-	for (i = 0; i < w * h; ++i, pix += 4)
+	lab_tables_init();
+	
+	/* derive average color of visible pixels; the loop body
+	 * is branch-free so it vectorizes when simd is available
+	 */
+	#pragma omp simd reduction(+:L,A,B,found)
+	for (int i = 0; i < n; ++i)
 	{
-		unsigned char *p = pix;
+		unsigned char *p = &pix[i * 4];
+		double conv[3];
+		int visible = !!(p[3] & 0x80);
 		
-		/* skip invisible pixels */
-		if (!(p[3]&0x80))
-			continue;
-		
-		/* add color to average */
-		double *conv = rgb2lab(p);
-		lab[0] += conv[0];
-		lab[1] += conv[1];
-		lab[2] += conv[2];
-		found += 1;
+		/* add color to average (skip invisible pixels) */
+		rgb2lab(p, conv);
+		L += visible ? conv[0] : 0;
+		A += visible ? conv[1] : 0;
+		B += visible ? conv[2] : 0;
+		found += visible;
 	}
 	if (found)
 	{
-		lab[0] /= found;
-		lab[1] /= found;
-		lab[2] /= found;
+		lab[0] = L / found;
+		lab[1] = A / found;
+		lab[2] = B / found;
+		
+		unsigned char rgb[3];
 		
-		unsigned char *rgb = lab2rgb(lab);
+		lab2rgb(lab, rgb);
 		alpha |= ((int)rgb[0]) << 24;
 		alpha |= ((int)rgb[1]) << 16;
 		alpha |= ((int)rgb[2]) <<  8;
@@ -1722,6 +1898,11 @@ acfunc_average(ACFUNC_ARGS)
 
 /* 
  * if (max_alpha_colors == 0), the indexing steps are skipped
+ * 
+ * every invisible pixel takes the color of its nearest (manhattan)
+ * edge pixel; ties go to the neighbor above, left, right, then below,
+ * which is the order the old iterative grow wrote pixels in, so the
+ * resulting colors are identical to what it produced
  */
 static
 int
@@ -1729,200 +1910,163 @@ acfunc_edge_expand(ACFUNC_ARGS)
 {
 #define PINV(X) (!(X[3]))
 	unsigned char *pix = rgba8888;
-	unsigned char *EDpix;         /* edge-detected image */
-	unsigned char *EDcolor;       /* color list containing only solids */
+	unsigned char *EDcolor;       /* color list containing only edges */
 	unsigned int   n_EDcolor = 0; /* num pixels in EDcolor */
+	int           *dist;          /* distance to nearest edge pixel */
+	int           *link;          /* where each pixel gets its color */
+	int            dist_max = w + h; /* farther than any real distance */
+	int            n = w * h;
 	
-	/* alloc edge-detected image */
-	if (max_alpha_colors == 0)
-	{
-		/* color indexing is disabled, so skip that step */
-		EDpix = realloc(0, w * h * 4);
-		memcpy(EDpix, pix, w * h * 4);
-		goto L_skip_indexing;
-	}
-	else
-		EDpix = calloc(1, w * h * 4);
+	dist = realloc(0, n * sizeof(*dist));
+	link = realloc(0, n * sizeof(*link));
 	
-	/* first pass: construct edge-detected image */
-	/* loop through every row */
+	/* first pass: find edge pixels; these seed the distance map */
+	#pragma omp parallel for
 	for (int y = 0; y < h; ++y)
 	{
-		/* loop through every column */
 		for (int x = 0; x < w; ++x)
 		{
-			unsigned char  *pC  =   &   pix[y * w * 4 + x * 4];
-			unsigned char  *edC  =  & EDpix[y * w * 4 + x * 4];
+			unsigned char *pC = &pix[y * w * 4 + x * 4];
+			int           *d  = &dist[y * w + x];
+			
+			*d = dist_max;
 			
 			/* skip invisible pixels */
 			if (PINV(pC))
 				continue;
 			
-			/* sample pixels above below left and right of current */
-			int yup    = imx(y - 1,     0);
-			int ydown  = imn(y + 1, h - 1);
-			int xleft  = imx(x - 1,     0);
-			int xright = imn(x + 1, w - 1);
-			unsigned char  *pUP     = &pix[ yup   * w * 4 + x * 4      ];
-			unsigned char  *pDOWN   = &pix[ ydown * w * 4 + x * 4      ];
-			unsigned char  *pLEFT   = &pix[ y     * w * 4 + xleft  * 4 ];
-			unsigned char  *pRIGHT  = &pix[ y     * w * 4 + xright * 4 ];
-			
-			/* if any sampled pixel is invisible, xfer to edge map */
-			if (PINV(pUP) || PINV(pDOWN) || PINV(pLEFT) || PINV(pRIGHT))
+			/* color indexing disabled: every visible pixel is a seed */
+			if (max_alpha_colors)
 			{
-				edC[0] = pC[0];
-				edC[1] = pC[1];
-				edC[2] = pC[2];
-				edC[3] = pC[3];
-				n_EDcolor += 1;
+				/* sample pixels above below left and right of current */
+				int yup    = imx(y - 1,     0);
+				int ydown  = imn(y + 1, h - 1);
+				int xleft  = imx(x - 1,     0);
+				int xright = imn(x + 1, w - 1);
+				unsigned char  *pUP     = &pix[ yup   * w * 4 + x * 4      ];
+				unsigned char  *pDOWN   = &pix[ ydown * w * 4 + x * 4      ];
+				unsigned char  *pLEFT   = &pix[ y     * w * 4 + xleft  * 4 ];
+				unsigned char  *pRIGHT  = &pix[ y     * w * 4 + xright * 4 ];
+				
+				/* not on an edge */
+				if (!(PINV(pUP) || PINV(pDOWN) || PINV(pLEFT) || PINV(pRIGHT)))
+					continue;
 			}
+			
+			/* the iterative grow mistook alpha 0x01 for a pixel it had
+			 * just processed, so such pixels began spreading one step
+			 * late; seeding them at distance 1 reproduces that
+			 */
+			*d = (pC[3] == 0x01);
 		}
 	}
 	
-	/* allocate list of colors in edge-detected image */
+	/* second pass: propagate color list, in raster order */
+	for (int i = 0; i < n; ++i)
+		if (dist[i] < dist_max)
+			n_EDcolor += 1;
 	EDcolor = realloc(0, n_EDcolor * 4);
-	
-	/* second pass: propagate color list */
 	n_EDcolor = 0;
-	/* loop through every row */
-	for (int y = 0; y < h; ++y)
+	for (int i = 0; i < n; ++i)
 	{
-		/* loop through every column */
-		for (int x = 0; x < w; ++x)
-		{
-			unsigned char *c = &EDpix[y * w * 4 + x * 4];
-			
-			/* skip invisible pixels */
-			if (PINV(c))
-				continue;
-			
-			/* all visible pixels get added to the color map */
-			EDcolor[n_EDcolor * 4 + 0] = c[0];
-			EDcolor[n_EDcolor * 4 + 1] = c[1];
-			EDcolor[n_EDcolor * 4 + 2] = c[2];
-			EDcolor[n_EDcolor * 4 + 3] = c[3];
-			n_EDcolor += 1;
-		}
+		if (dist[i] == dist_max)
+			continue;
+		
+		memcpy(&EDcolor[n_EDcolor * 4], &pix[i * 4], 4);
+		link[i] = -1 - n_EDcolor; /* < 0: links to color list */
+		n_EDcolor += 1;
 	}
 	
 	/* quantize color list */
-	color_quant(
-		EDcolor
-		, n_EDcolor
-		, 1
-		, max_alpha_colors
-		, 0
-		, calloc
-		, realloc
-		, free
-	);
+	if (max_alpha_colors)
+		color_quant(
+			EDcolor
+			, n_EDcolor
+			, 1
+			, max_alpha_colors
+			, 0
+			, calloc
+			, realloc
+			, free
+		);
 	
-	/* third pass: xfer color list colors back to edge-detected image */
-	n_EDcolor = 0;
-	/* loop through every row */
+	/* third pass: manhattan distance transform, columns then rows */
+	#pragma omp parallel for
+	for (int x = 0; x < w; ++x)
+	{
+		int *d = &dist[x];
+		
+		for (int y = 1; y < h; ++y)
+			d[y * w] = imn(d[y * w], d[(y - 1) * w] + 1);
+		for (int y = h - 2; y >= 0; --y)
+			d[y * w] = imn(d[y * w], d[(y + 1) * w] + 1);
+	}
+	#pragma omp parallel for
+	for (int y = 0; y < h; ++y)
+	{
+		int *d = &dist[y * w];
+		
+		for (int x = 1; x < w; ++x)
+			d[x] = imn(d[x], d[x - 1] + 1);
+		for (int x = w - 2; x >= 0; --x)
+			d[x] = imn(d[x], d[x + 1] + 1);
+	}
+	
+	/* fourth pass: link every invisible pixel to the first neighbor *
+	 * that is closer to an edge (above, left, right, then below)    */
+	#pragma omp parallel for
 	for (int y = 0; y < h; ++y)
 	{
-		/* loop through every column */
 		for (int x = 0; x < w; ++x)
 		{
-			unsigned char *c = &EDpix[y * w * 4 + x * 4];
+			int i = y * w + x;
+			int d = dist[i];
 			
-			/* skip invisible pixels */
-			if (PINV(c))
+			if (!PINV((&pix[i * 4])))
 				continue;
 			
-			/* all visible pixels retrieve new value from color list */
-			c[0] = EDcolor[n_EDcolor * 4 + 0];
-			c[1] = EDcolor[n_EDcolor * 4 + 1];
-			c[2] = EDcolor[n_EDcolor * 4 + 2];
-			c[3] = EDcolor[n_EDcolor * 4 + 3];
-			n_EDcolor += 1;
+			if (y > 0 && dist[i - w] < d)
+				link[i] = i - w;
+			else if (x > 0 && dist[i - 1] < d)
+				link[i] = i - 1;
+			else if (x < w - 1 && dist[i + 1] < d)
+				link[i] = i + 1;
+			else
+				link[i] = i + w;
 		}
 	}
-	free(EDcolor);
-	
-L_skip_indexing: do{}while(0);
-	/* at this point, `EDpix` contains a color-reduced     *
-	 * edge-detected copy of the input rgba8888 pixel data */
-	/* if color-indexing is disabled, it will contain an   *
-	 * exact copy of the input pixel data `rgba8888`       */
 	
-	/* expand every pixel */
-	int has_invis = 1;
-	while (has_invis)
+	/* transfer alpha colors to original image; links only ever    *
+	 * pass through invisible pixels before reaching an edge pixel */
+	for (int i = 0; i < n; ++i)
 	{
-		has_invis = 0;
-		/* loop through every row */
-		for (int y = 0; y < h; ++y)
-		{
-			/* loop through every column */
-			for (int x = 0; x < w; ++x)
-			{
-				unsigned char  *pC  = & EDpix[y * w * 4 + x * 4];
-				
-				/* skip invisible pixels, and pixels just processed */
-				if (PINV(pC) || (pC[3] == 0x01))
-					continue;
-				
-				/* sample pixels above below left and right of current */
-				int yup    = imx(y - 1,     0);
-				int ydown  = imn(y + 1, h - 1);
-				int xleft  = imx(x - 1,     0);
-				int xright = imn(x + 1, w - 1);
-				unsigned char  *pUP     = &EDpix[ yup   * w * 4 + x * 4  ];
-				unsigned char  *pDOWN   = &EDpix[ ydown * w * 4 + x * 4  ];
-				unsigned char  *pLEFT   = &EDpix[ y     * w * 4 + xleft*4];
-				unsigned char  *pRIGHT  = &EDpix[ y     * w * 4 + xright*4];
-				
-				/* if any sampled pixel is invisible, edit *
-				 * color and mark as just processed        */
-				#define PXPROC(P)          \
-					if (PINV(P)) {          \
-						P[0] = pC[0];        \
-						P[1] = pC[1];        \
-						P[2] = pC[2];        \
-						P[3] = 0x01;         \
-					}
-				PXPROC(pUP)
-				PXPROC(pDOWN)
-				PXPROC(pLEFT)
-				PXPROC(pRIGHT)
-				#undef PXPROC
-			}
-		}
+		unsigned char *c;
+		int r;
+		int next;
 		
-		/* stepped through image once; mark all processed pixels *
-		 * as regular opaque pixels for the next iteration       */
-		unsigned int i;
-		for (i = 0; i < w * h; ++i)
+		if (!PINV((&pix[i * 4])))
+			continue;
+		
+		/* follow links to the edge, then shorten the path taken */
+		for (r = i; r >= 0; r = link[r])
+			;
+		for (int j = i; link[j] >= 0; j = next)
 		{
-			if (EDpix[i*4+3])
-				EDpix[i*4+3] = 0xFF;
-			else
-				has_invis = 1;
+			next = link[j];
+			link[j] = r;
 		}
+		
+		c = &EDcolor[(-1 - r) * 4];
+		pix[i*4+0] = c[0];
+		pix[i*4+1] = c[1];
+		pix[i*4+2] = c[2];
+		pix[i*4+3] = 0; /* 0xFF can be used to test result as png */
 	}
 	
-#if 0
-	/* this test is to see result quickly */
-	memcpy(pix, EDpix, w * h * 4);
-#endif
-	
-	/* transfer alpha colors to original image */
-	for (unsigned int i = 0; i < w * h; ++i)
-		if (!pix[i*4+3])
-		//if (PINV(pix[i*4]))
-		{
-			pix[i*4+0] = EDpix[i*4+0];
-			pix[i*4+1] = EDpix[i*4+1];
-			pix[i*4+2] = EDpix[i*4+2];
-			pix[i*4+3] = 0; /* 0xFF can be used to test result as png */
-		}
-	
 	/* cleanup */
-	free(EDpix);
-	/* don't worry, EDcolor was freed earlier */
+	free(EDcolor);
+	free(dist);
+	free(link);
 	
 	/* num unique alpha colors in image */
 	return max_alpha_colors;
@@ -88,6 +88,26 @@ n64texconv_to_n64(
 );
 
 
+/* convert gray (`channels` = 1) or gray + alpha (`channels` = 2) pixel
+ * data straight to an i or ia format, skipping RGBA8888 expansion;
+ * the result matches n64texconv_to_n64 on the expanded pixels
+ * returns 0 (NULL) on success, pointer to error string otherwise
+ * 16-bit formats require `channels` = 2
+ * NOTE: `dst` and `pix` can be the same to convert in-place
+ */
+const char *
+n64texconv_gray_to_n64(
+	unsigned char *dst
+	, unsigned char *pix
+	, int channels
+	, enum n64texconv_fmt fmt
+	, enum n64texconv_bpp bpp
+	, int w
+	, int h
+	, unsigned int *sz
+);
+
+
 /* convert RGBA8888 to N64 texture data and back, reducing color depth
  * returns 0 on success, pointer to error string otherwise
  */
@@ -105,6 +125,7 @@ n64texconv_to_n64_and_back(
 
 /* quantize an image and construct a palette of rgba8888 colors */
 /* (in other words, palette-ify it) */
+/* `dither` != 0 applies error diffusion */
 int
 n64texconv_palette_ify(
 	void *srcdst
@@ -132,6 +153,7 @@ n64texconv_palette_new(
 
 
 /* adds an rgba8888 image to a palette context's queue */
+/* `dither` != 0 applies error diffusion when the palette is applied */
 void
 n64texconv_palette_queue(
 	struct n64texconv_palctx *ctx
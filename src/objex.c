@@ -1618,6 +1618,27 @@ if (tex && !tex->filename) \
 				return errmsg(ERR_NOMEM);
 			strcpy(tex->alphamode, name);
 		}
+		else if (streq32(ss, "dither "))
+		{
+			const char *name;
+			ASSERT_TEX
+			
+			if (tex->dither)
+				return errmsg(
+					"texture '%s': 'dither' used multiple times"
+					, tex->name
+				);
+			
+			if (!(name = nexttok_linerem(ss, 1)))
+				return errmsg(
+					"could not fetch dither mode from '%.*s'"
+					, strcspn(ss, "\r\n"), ss
+				);
+			
+			if (!(tex->dither = calloc(1, strlen(name)+1)))
+				return errmsg(ERR_NOMEM);
+			strcpy(tex->dither, name);
+		}
 		/* checking tex first is important b/c this will be invoked
 		 * for material priority as well otherwise
 		 */
@@ -1813,6 +1834,7 @@ if (tex && !tex->filename) \
 		{
 			ASSERT_MTL
 			mtl->isStandalone = 1;
+			mtl->isStandaloneMarked = 1;
 		}
 		else if (streq32(ss, "empty"))
 		{
@@ -3225,6 +3247,15 @@ void *objex_divide(struct objex *objex, FILE *docs)
 		objex->mtlNum = 0;
 	}
 	
+	/* identical textures used from other files go to common */
+	for (struct objex_texture *tex = objex->tex; tex; tex = tex->next)
+	{
+		struct objex_texture *src = tex->aliasOf;
+		
+		if (src && tex->file && tex->file != src->file)
+			src->isMultiFile = 1;
+	}
+	
 	/* textures and palettes */
 	{
 		struct objex_texture *next = 0;
@@ -3767,6 +3798,7 @@ void objex_free(struct objex *objex, void free(void *))
 		if (tex->format) free(tex->format);
 		if (tex->pix) free(tex->pix);
 		if (tex->alphamode) free(tex->alphamode);
+		if (tex->dither) free(tex->dither);
 		free_if_udata(tex->udata);
 		free(tex);
 	}
@@ -140,6 +140,8 @@ struct objex_palette
 	unsigned int pointer; /* pointer override */
 	int isUsed;
 	int index; /* Nth item initialized, starting at 0 (order created) */
+	struct objex_palette *pooled; /* stored within this palette instead */
+	unsigned int pooledOfs; /* byte offset within pooled palette */
 };
 
 /* texture */
@@ -150,11 +152,13 @@ struct objex_texture
 	struct objex_palette *palette;
 	struct objex_texture *commonRef;
 	struct objex_texture *copyOf;
+	struct objex_texture *aliasOf; /* identical texture loaded earlier */
 	struct objex_file *file;
 	struct objex *objex;
 	OBJ_NAMECONST char *filename;  /* filename used for loading texture */
 	char *format;    /* custom format string */
 	char *alphamode; /* alphamode magic */
+	char *dither;    /* dither mode */
 	OBJ_NAMECONST char *name;      /* name used for finding */
 	OBJ_NAMECONST char *instead;   /* file to use pixel data from instead */
 	void *pix;       /* rgba pixel data */
@@ -192,6 +196,7 @@ struct objex_material
 	int attribLen;
 	int isUsed;
 	int isStandalone;
+	int isStandaloneMarked; /* 'standalone' in mtlex */
 	int isEmpty;
 	int isMultiFile;
 	int alwaysUsed;
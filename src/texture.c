@@ -1,5 +1,14 @@
 /* <z64.me> texture to n64 utility */
+#define _FILE_OFFSET_BITS 64 /* spill files past 2 GiB */
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#ifdef _WIN32
+#include <io.h> /* _mktemp */
+#else
+#include <unistd.h> /* unlink, close */
+#endif
+#include <math.h>
 #include <limits.h>
 #include <string.h>
 #include <stdbool.h>
@@ -58,6 +67,23 @@ static enum n64texconv_acgen parse_alphamode(const char *str)
 	
 	return N64TEXCONV_ACGEN_MAX;
 }
+
+/* returns dither flag for texture, or -1 if unknown mode */
+static int parse_dither(const char *str)
+{
+	extern int ditherTextures;
+	
+	if (!str)
+		return ditherTextures;
+	
+	if (!strcmp(str, "none"))
+		return 0;
+	
+	if (!strcmp(str, "diffuse"))
+		return 1;
+	
+	return -1;
+}
 	
 static const char *fmtStr[] = { "rgba", "yuv", "ci", "ia", "i" };
 static const char *bppStr[] = { "4", "8", "16", "32" };
@@ -178,6 +204,128 @@ int texture_textureFmt(struct objex_texture *tex)
 	return fmt;
 }
 
+/* determine the format a texture will be converted to */
+static void *resolveFmtBpp(
+	struct objex_texture *tex
+	, enum n64texconv_fmt *_fmt
+	, enum n64texconv_bpp *_bpp
+)
+{
+	const char *errstr;
+	enum n64texconv_fmt fmt;
+	enum n64texconv_bpp bpp;
+	
+#undef fail
+#define fail(...) {                    \
+   errmsg(__VA_ARGS__);                \
+   return 0;                           \
+}
+	
+	/* custom format string */
+	if (tex->format)
+	{
+		if (!getFmtBpp(tex, &fmt, &bpp))
+			return errmsg(0);
+	}
+	else if (tex->paletteSlot || tex->instead)
+	{
+		/* palette slots without a format
+		 * specified default to ci8
+		 */
+		fmt = N64TEXCONV_CI;
+		bpp = N64TEXCONV_8;
+	}
+	else
+	{
+		/* format must be specified if texture pointer override
+		 * (except when texture bank (tex->instead) is specified) */
+		if (tex->pointer && !tex->format)
+			fail(
+				"'%s': format must be specified for texture %08X"
+				, tex->filename
+				, tex->pointer
+			);
+		/* no format specified, so let's try for the best */
+		if ((errstr = n64texconv_best_format(tex->pix, &fmt, &bpp, tex->w, tex->h)))
+			fail("'%s' conversion error: %s", tex->filename, errstr);
+		/* fall back to rgba16 if rgba32 */
+		if (bpp == N64TEXCONV_32)
+			bpp = N64TEXCONV_16;
+		/* force ci8 on rgba16 */
+		if (fmt == N64TEXCONV_RGBA && bpp == N64TEXCONV_16)
+		{
+			fmt = N64TEXCONV_CI;
+			bpp = N64TEXCONV_8;
+		}
+	}
+	/* yuv, sneaky zelda fans */
+	if (fmt == N64TEXCONV_YUV)
+		fail("yuv is not supported");
+	if (tex->paletteSlot && fmt != N64TEXCONV_CI)
+		fail("texture '%s' palette slot %d but format == '%s'"
+			, tex->name, tex->paletteSlot, fmtStr[fmt]
+		);
+	
+	/* ensure minimum size magic */
+	{const char *x = n64texconv_min_size(&fmt, &bpp, tex->w, tex->h);
+	if (x)
+		fail("texture '%s' conversion error: %s", tex->name, x);
+	}
+	
+	
+	*_fmt = fmt;
+	*_bpp = bpp;
+	
+	return success;
+#undef fail
+}
+
+static int strnull_eq(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+	return !strcmp(a, b);
+}
+
+/* can `tex` share the image data and conversion of `other`? */
+static int isAlias(struct objex_texture *tex, struct objex_texture *other)
+{
+	struct texUdata *a = tex->udata;
+	struct texUdata *b = other->udata;
+	
+	/* texture banks and pointer overrides are left alone */
+	if (tex->instead || other->instead
+		|| tex->pointer || other->pointer
+		|| other->aliasOf
+	)
+		return 0;
+	
+	/* nothing left to compare once converted (--max-memory) */
+	if (b->fileSz)
+		return 0;
+	
+	/* conversion settings must match */
+	if (!strnull_eq(tex->format, other->format)
+		|| !strnull_eq(tex->alphamode, other->alphamode)
+		|| !strnull_eq(tex->dither, other->dither)
+		|| tex->paletteSlot != other->paletteSlot
+		|| tex->alwaysUnused != other->alwaysUnused
+	)
+		return 0;
+	
+	/* as must the image data */
+	return tex->crc32 == other->crc32
+		&& tex->w == other->w
+		&& tex->h == other->h
+		&& a->isSmirror == b->isSmirror
+		&& a->isTmirror == b->isTmirror
+		&& a->uvMult.w == b->uvMult.w
+		&& a->uvMult.h == b->uvMult.h
+		&& a->pixChannels == b->pixChannels
+		&& !memcmp(tex->pix, other->pix, tex->w * tex->h * a->pixChannels)
+	;
+}
+
 static int pathIsAbsolute(const char *path)
 {
 #ifdef _WIN32 /* win32: */
@@ -188,6 +336,327 @@ static int pathIsAbsolute(const char *path)
 #endif
 }
 
+/* converted texture data set aside to stay within --max-memory */
+static FILE *gSpill = 0;
+
+/* spill file offsets are 64-bit everywhere, including win32's long */
+#ifdef _WIN32
+#define spill_seek _fseeki64
+#define spill_tell _ftelli64
+#else
+#define spill_seek fseeko
+#define spill_tell ftello
+#endif
+
+/* opens a spill file in the system's temp directory, which is removed
+ * once closed; tmpfile() on win32 writes to the root of the current
+ * drive, which users without admin rights can't
+ */
+static FILE *spillOpen(void)
+{
+	const char *dir = getenv("TMPDIR");
+	char name[4096];
+	
+	if (!dir)
+		dir = getenv("TMP");
+	if (!dir)
+		dir = getenv("TEMP");
+	
+#ifdef _WIN32 /* win32: */
+	if (!dir)
+		dir = ".";
+	snprintf(name, sizeof(name), "%s\\z64convert-XXXXXX", dir);
+	if (!_mktemp(name))
+		return 0;
+	
+	/* D = delete once closed */
+	return fopen(name, "w+bD");
+#else /* linux: */
+	FILE *fp;
+	int fd;
+	
+	if (!dir)
+		dir = "/tmp";
+	snprintf(name, sizeof(name), "%s/z64convert-XXXXXX", dir);
+	if ((fd = mkstemp(name)) < 0)
+		return 0;
+	
+	/* no name to leave behind, the open file stays usable */
+	unlink(name);
+	if (!(fp = fdopen(fd, "w+b")))
+		close(fd);
+	return fp;
+#endif
+}
+
+/* bytes of pixel data a texture holds in memory */
+static size_t pixBytes(struct objex_texture *tex)
+{
+	struct texUdata *udata = tex->udata;
+	
+	if (!tex->pix)
+		return 0;
+	if (udata && udata->fileSz)
+		return udata->fileSz;
+	return tex->w * tex->h * (udata ? udata->pixChannels : 4);
+}
+
+/* once converted, a texture keeps only the converted bytes */
+static void shrinkPix(struct objex_texture *tex)
+{
+	struct texUdata *udata = tex->udata;
+	void *pix;
+	
+	if (!tex->pix || !udata || !udata->fileSz)
+		return;
+	
+	if ((pix = realloc(tex->pix, udata->fileSz)))
+		tex->pix = pix;
+}
+
+/* done with the textures spilled so far, like when a conversion ends */
+void texture_closeSpill(void)
+{
+	if (!gSpill)
+		return;
+	
+	fclose(gSpill);
+	gSpill = 0;
+}
+
+/* moves converted data out of memory, into the spill file */
+static void *spillPix(struct objex_texture *tex)
+{
+	struct texUdata *udata = tex->udata;
+	
+	if (!gSpill && !(gSpill = spillOpen()))
+		return errmsg("failed to create texture spill file");
+	
+	if (spill_seek(gSpill, 0, SEEK_END)
+		|| (udata->spillOfs = spill_tell(gSpill)) < 0
+		|| fwrite(tex->pix, 1, udata->fileSz, gSpill) != udata->fileSz
+	)
+		return errmsg("failed to write texture spill file");
+	
+	free(tex->pix);
+	tex->pix = 0;
+	udata->isSpilled = 1;
+	
+	return success;
+}
+
+/* reads spilled data of a texture into `dst` */
+static void *readSpill(const struct objex_texture *tex, void *dst)
+{
+	const struct texUdata *udata = tex->udata;
+	
+	if (!gSpill
+		|| spill_seek(gSpill, udata->spillOfs, SEEK_SET)
+		|| fread(dst, 1, udata->fileSz, gSpill) != udata->fileSz
+	)
+		return errmsg("failed to read texture spill file");
+	
+	return success;
+}
+
+/* converted data of a texture; spilled data is read into a buffer
+ * that `*tmp` points to afterwards, and the caller frees it
+ */
+static const void *texData(const struct objex_texture *tex, void **tmp)
+{
+	const struct texUdata *udata = tex->udata;
+	
+	*tmp = 0;
+	if (!udata || !udata->isSpilled)
+		return tex->pix;
+	
+	if (!(*tmp = malloc(udata->fileSz)))
+		return errmsg(ERR_NOMEM);
+	if (!readSpill(tex, *tmp))
+	{
+		free(*tmp);
+		*tmp = 0;
+		return 0;
+	}
+	
+	return *tmp;
+}
+
+/* brings spilled data of a texture back into memory */
+static void *unspillPix(struct objex_texture *tex)
+{
+	struct texUdata *udata = tex->udata;
+	void *pix;
+	
+	if (!udata || !udata->isSpilled)
+		return success;
+	
+	if (!(pix = malloc(udata->fileSz)))
+		return errmsg(ERR_NOMEM);
+	if (!readSpill(tex, pix))
+	{
+		free(pix);
+		return 0;
+	}
+	tex->pix = pix;
+	udata->isSpilled = 0;
+	
+	return success;
+}
+
+static void *relieveMemory(struct objex *obj, struct objex_texture *end);
+
+/* whether a texture can be reduced to one of its repeating tiles
+ * along s (0) or t (1); the masks of every material using it must
+ * follow the texture size, and nothing may mirror it already
+ */
+static bool canRepeat(struct objex *obj, struct objex_texture *tex, int t)
+{
+	for (struct objex_material *mtl = obj->mtl; mtl; mtl = mtl->next)
+	{
+		for (int i = 0; i < 2; ++i)
+		{
+			int o = i * (OBJEX_GBIVAR_CMS1 - OBJEX_GBIVAR_CMS0);
+			const char *cm = mtl->gbivar[(t ? OBJEX_GBIVAR_CMT0 : OBJEX_GBIVAR_CMS0) + o];
+			const char *mask = mtl->gbivar[(t ? OBJEX_GBIVAR_MASKT0 : OBJEX_GBIVAR_MASKS0) + o];
+			
+			if ((i ? mtl->tex1 : mtl->tex0) != tex)
+				continue;
+			
+			if ((cm && strstr(cm, "MIRROR") && !strstr(cm, "NOMIRROR"))
+				|| !mask
+				|| strncmp(mask, "_texel", 6)
+			)
+				return false;
+		}
+	}
+	
+	return true;
+}
+
+/* one gray (+ alpha) pixel of `c` bytes as rgba8888, the way
+ * stb_image would have expanded it; `c` = 4 copies it as-is
+ */
+static void grayToRgba(unsigned char dst[4], const unsigned char *src, int c)
+{
+	unsigned char v = src[0];
+	unsigned char a = (c == 2) ? src[1] : (c == 4) ? src[3] : 255;
+	
+	dst[0] = v;
+	dst[1] = (c == 4) ? src[1] : v;
+	dst[2] = (c == 4) ? src[2] : v;
+	dst[3] = a;
+}
+
+/* how many bytes per pixel to decode a texture's image with; i and
+ * ia textures from gray images can skip rgba8888 entirely, as they
+ * are converted straight from gray (see n64texconv_gray_to_n64)
+ */
+static int grayChannels(struct objex_texture *tex, const char *fn)
+{
+	enum n64texconv_fmt fmt;
+	enum n64texconv_bpp bpp;
+	int w;
+	int h;
+	int n;
+	
+	if (!tex->format
+		|| tex->paletteSlot
+		|| !getFmtBpp(tex, &fmt, &bpp)
+		|| (fmt != N64TEXCONV_I && fmt != N64TEXCONV_IA)
+		|| bpp > N64TEXCONV_16
+		|| parse_alphamode(tex->alphamode) >= N64TEXCONV_ACGEN_MAX
+		|| !stbi_info(fn, &w, &h, &n)
+		|| n > 2
+	)
+		return 4;
+	
+	/* ia16 is converted in-place, so it needs room for alpha */
+	if (bpp == N64TEXCONV_16)
+		return 2;
+	
+	return n;
+}
+
+/* whether n64texconv_acgen would change any pixel of a texture that
+ * was decoded as gray + alpha; those go through rgba8888 after all
+ */
+static bool grayNeedsAcgen(struct objex_texture *tex)
+{
+	struct texUdata *udata = tex->udata;
+	const unsigned char *p = tex->pix;
+	bool isEdgeI = texture_textureFmt(tex) == N64TEXCONV_I
+		&& tex->alphamode
+		&& parse_alphamode(tex->alphamode) == N64TEXCONV_ACGEN_EDGEXPAND
+	;
+	
+	if (udata->pixChannels != 2)
+		return false;
+	
+	/* invisible pixels get new colors, and `edge` clamps `i` */
+	for (int i = 0; i < tex->w * tex->h; ++i, p += 2)
+		if (!p[1] || (isEdgeI && p[1] < p[0]))
+			return true;
+	
+	return false;
+}
+
+/* expands gray (+ alpha) pixel data to rgba8888 */
+static void *expandPix(struct objex_texture *tex)
+{
+	struct texUdata *udata = tex->udata;
+	int c = udata->pixChannels;
+	unsigned char *pix;
+	
+	if (c == 4)
+		return success;
+	
+	if (!(pix = realloc(tex->pix, tex->w * tex->h * 4)))
+		return errmsg(ERR_NOMEM);
+	tex->pix = pix;
+	
+	/* back to front, so nothing is overwritten before it's read */
+	for (int i = tex->w * tex->h - 1; i >= 0; --i)
+	{
+		unsigned char src[2] = { pix[i * c], pix[i * c + c - 1] };
+		
+		grayToRgba(pix + i * 4, src, c);
+	}
+	udata->pixChannels = 4;
+	
+	return success;
+}
+
+/* whether a row of `w` pixels of `c` bytes mirrors itself */
+static bool rowIsMirrored(const void *row, int w, int c)
+{
+	unsigned diff = 0;
+	
+	if (c == 4)
+	{
+		const uint32_t *r = row;
+		#pragma omp simd reduction(|:diff)
+		for (int x = 0; x < w / 2; ++x)
+			diff |= r[x] ^ r[w - 1 - x];
+	}
+	else if (c == 2)
+	{
+		const uint16_t *r = row;
+		#pragma omp simd reduction(|:diff)
+		for (int x = 0; x < w / 2; ++x)
+			diff |= r[x] ^ r[w - 1 - x];
+	}
+	else
+	{
+		const uint8_t *r = row;
+		#pragma omp simd reduction(|:diff)
+		for (int x = 0; x < w / 2; ++x)
+			diff |= r[x] ^ r[w - 1 - x];
+	}
+	
+	return !diff;
+}
+
 void *texture_loadAll(struct objex *obj)
 {
 	/* load all the textures */
@@ -197,6 +666,7 @@ void *texture_loadAll(struct objex *obj)
 		const char *which;
 		const char *instead = tex->instead;
 		char fn[PATH_MAX];
+		int chans;
 		int n;
 		
 		/* load texture data */
@@ -221,7 +691,8 @@ void *texture_loadAll(struct objex *obj)
 		}
 		
 		/* load texture file */
-		if (!(tex->pix = stbi_load(fn, &tex->w, &tex->h, &n, 4)))
+		chans = grayChannels(tex, fn);
+		if (!(tex->pix = stbi_load(fn, &tex->w, &tex->h, &n, chans)))
 			return errmsg(
 				"texture image '%s' failed: %s"
 				, which, stbi_failure_reason()
@@ -234,6 +705,10 @@ void *texture_loadAll(struct objex *obj)
 		udata->virtDiv = 1; /* we divide by this, guarantee non-0 */
 		udata->uvMult.w = 1; /* we multiply by this, 1 = default */
 		udata->uvMult.h = 1;
+		udata->pixChannels = chans;
+		if (grayNeedsAcgen(tex) && !expandPix(tex))
+			return errmsg(0);
+		chans = udata->pixChannels;
 		
 		/* we just loaded pixel data for a texture strip */
 		if (which == instead)
@@ -282,22 +757,58 @@ void *texture_loadAll(struct objex *obj)
 		/* one texture otherwise */
 		else
 		{
-			/* detect mirror, crop texture */
-			/* TODO wrapping detection (not important for now) */
+			/* detect repeats and mirroring, crop texture */
 			unsigned char *p = tex->pix;
+			int c = chans;
 			int w = tex->w;
 			int h = tex->h;
+			int period;
 			int i;
 			
+			/* repeating tiles; power of two, so masks can repeat them */
+			if (!(h & (h - 1)) && canRepeat(obj, tex, 1))
+			{
+				for (period = h; period / 2 >= 8; period /= 2)
+					if (memcmp(p, p + (period / 2) * w * c, (h - period / 2) * w * c))
+						break;
+				
+				if (period < h)
+				{
+					udata->uvMult.h = h / period;
+					h = tex->h = period;
+				}
+			}
+			if (!(w & (w - 1)) && canRepeat(obj, tex, 0))
+			{
+				for (period = w; period / 2 >= 8; period /= 2)
+				{
+					int half = period / 2;
+					
+					for (i = 0; i < h; ++i)
+						if (memcmp(p + i * w * c, p + (i * w + half) * c, (w - half) * c))
+							break;
+					if (i < h)
+						break;
+				}
+				
+				if (period < w)
+				{
+					for (i = 1; i < h; ++i)
+						memmove(p + i * period * c, p + i * w * c, period * c);
+					udata->uvMult.w = w / period;
+					w = tex->w = period;
+				}
+			}
+			
 			/* only optimize textures at least this height */
 			if (h >= 16)
 			{
 				/* test vertical mirror */
 				for (i = 0; i < h / 2; ++i)
 				{
-					if (memcmp(p + i * w * 4 /* first row */
-						, p + (h - (i + 1)) * w * 4 /* last row */
-						, w * 4 /* row width (bytes) */
+					if (memcmp(p + i * w * c /* first row */
+						, p + (h - (i + 1)) * w * c /* last row */
+						, w * c /* row width (bytes) */
 					))
 						break;
 				}
@@ -306,7 +817,7 @@ void *texture_loadAll(struct objex *obj)
 				{
 					/* halve texture vertically */
 					h = tex->h = h / 2;
-					udata->uvMult.h = 2;
+					udata->uvMult.h *= 2;
 					udata->isTmirror = 1;
 				}
 			}
@@ -316,39 +827,32 @@ void *texture_loadAll(struct objex *obj)
 			{
 				/* test horizontal mirror */
 				for (i = 0; i < h; ++i)
-				{
-					uint32_t *p1 = (void*)(p + i * w * 4); /* left side */
-					uint32_t *p2 = p1 + (w - 1); /* right side */
-					int c;
-					
-					for (c = 0; c < w / 2; ++c)
-					{
-						if (*p1 != *p2)
-							break;
-						++p1;
-						--p2;
-					}
-					if (c < w / 2)
+					if (!rowIsMirrored(p + i * w * c, w, c))
 						break;
-				}
 				/* image is mirrored horizontally */
 				if (i == h)
 				{
 					/* halve texture horizontally */
 					for (i = 1; i < h; ++i)
 					{
-						void *p1 = p + i * w * 4 / 2; /* left side cropped */
-						void *p2 = p + i * w * 4;     /* left side full */
-						memcpy(p1, p2, w * 4 / 2);    /* copy half row */
+						void *p1 = p + i * w / 2 * c; /* left side cropped */
+						void *p2 = p + i * w * c;     /* left side full */
+						memcpy(p1, p2, w * c / 2);    /* copy half row */
 					}
 					w = tex->w = w / 2;
-					udata->uvMult.w = 2;
+					udata->uvMult.w *= 2;
 					udata->isSmirror = 1;
 				}
 			}
+			
+			/* let go of what was cropped away */
+			if ((udata->uvMult.w != 1 || udata->uvMult.h != 1)
+				&& (p = realloc(tex->pix, w * h * c))
+			)
+				tex->pix = p;
 		}
 		
-		tex->sz = tex->w * tex->h * 4; /* default format is rgba8888 */
+		tex->sz = tex->w * tex->h * chans; /* rgba8888 or gray, for now */
 		
 		/* do crc32 */
 		{
@@ -375,15 +879,21 @@ void *texture_loadAll(struct objex *obj)
 				}
 			}
 			
-			/* generate crc */
+			/* generate crc (of rgba8888, even if decoded as gray) */
 			if (tex->crc32 == 0)
 			{
 				unsigned char *pix8 = tex->pix;
-				int len = tex->w * tex->h * 4;
+				int len = tex->w * tex->h;
 				unsigned crc = ~0;
 				
-				for (int i = 0; i < len; ++i)
-					crc = (crc >> 8) ^ table[(crc ^ pix8[i]) & 0xff];
+				for (int i = 0; i < len; ++i, pix8 += chans)
+				{
+					unsigned char rgba[4];
+					
+					grayToRgba(rgba, pix8, chans);
+					for (int k = 0; k < 4; ++k)
+						crc = (crc >> 8) ^ table[(crc ^ rgba[k]) & 0xff];
+				}
 				
 				tex->crc32 = crc;
 			}
@@ -398,179 +908,935 @@ void *texture_loadAll(struct objex *obj)
 				, fn
 			);
 		}
+		
+		/* the same image may be referenced by several textures;
+		 * convert and write it only once, for the first of them
+		 */
+		for (struct objex_texture *other = obj->tex; other != tex; other = other->next)
+		{
+			if (!isAlias(tex, other))
+				continue;
+			
+			tex->aliasOf = other;
+			free(tex->pix);
+			tex->pix = 0;
+			break;
+		}
+		
+		/* stay within --max-memory */
+		if (!relieveMemory(obj, tex->next))
+			return errmsg(0);
 	}
 	return success;
 }
 
-/* process textures sharing palette slots */
-void *texture_procSharedPalettes(struct objex *obj)
+/* candidate format for automatic format selection */
+struct autofmt
 {
-	int prevHighest = 0;
-	while (1)
-	{
-		struct objex_palette *palStruct;
-		struct objex_texture *tex;
-		int bpp = 0;
-		int fmt = N64TEXCONV_CI;
-		int pal_max;
-		int pal_colors;
-		int highest;
-		int slot;
-		void *pal;
-		void *pbuf;
-		struct n64texconv_palctx *pctx = 0;
-		struct list *rme = 0;
-		int total_invisible = 0;
-		unsigned int pal_bytes;
-		void *next;
-		
-		/* select the highest not-yet-processed slot */
-		highest = 0;
-		for (tex = obj->tex; tex; tex = tex->next)
-		{
-			/* skip previous highest */
-			if (tex->paletteSlot > highest
-				&& (prevHighest == 0 || tex->paletteSlot < prevHighest)
+	enum n64texconv_fmt fmt;
+	enum n64texconv_bpp bpp;
+	unsigned footprint;    /* tmem bytes, texture + palette */
+	double psnr;           /* < 0 = unusable */
+};
+
+/* psnr (dB) of a texture converted to the given format, the same way
+ * texture_procTexture would convert it; alpha is compared everywhere,
+ * color only where the source is visible; returns < 0 on failure
+ */
+static double autofmt_psnr(
+	struct objex_texture *tex
+	, enum n64texconv_fmt fmt
+	, enum n64texconv_bpp bpp
+	, unsigned *footprint
+)
+{
+	enum n64texconv_acgen acfunc;
+	unsigned char *copy;
+	unsigned char *pal = 0;
+	unsigned char *p = tex->pix;
+	unsigned char *q;
+	int n = tex->w * tex->h;
+	double sse = 0;
+	double samples = 0;
+	int invisible;
+	int i;
+	
+	*footprint = (n << bpp) >> 1;
+	
+	if (fmt == N64TEXCONV_I && !tex->alphamode)
+		acfunc = N64TEXCONV_ACGEN_USER;
+	else
+		acfunc = parse_alphamode(tex->alphamode);
+	
+	if (!(copy = malloc(n * 4)))
+		return -1;
+	memcpy(copy, tex->pix, n * 4);
+	
+	invisible = n64texconv_acgen(
+		copy, tex->w, tex->h, acfunc, acfunc_colors
+		, calloc, realloc, free, fmt
+	);
+	if (invisible < 0)
+		goto L_fail;
+	
+	if (fmt == N64TEXCONV_CI)
+	{
+		int palMax = (bpp == N64TEXCONV_4) ? 16 : 256;
+		int palNum;
+		
+		if (!(pal = malloc(256 * 4)))
+			goto L_fail;
+		palNum = n64texconv_palette_ify(
+			copy, pal, tex->w, tex->h, palMax - invisible
+			, parse_dither(tex->dither), calloc, realloc, free
+		);
+		*footprint += palNum * 2;
+		
+		/* palette colors are stored as rgba5551 */
+		fmt = N64TEXCONV_RGBA;
+		bpp = N64TEXCONV_16;
+	}
+	if (n64texconv_to_n64_and_back(copy, 0, 0, fmt, bpp, tex->w, tex->h))
+		goto L_fail;
+	
+	for (i = 0, q = copy; i < n; ++i, p += 4, q += 4)
+	{
+		sse += (p[3] - q[3]) * (p[3] - q[3]);
+		samples += 1;
+		if (!p[3])
+			continue;
+		sse += (p[0] - q[0]) * (p[0] - q[0])
+			+ (p[1] - q[1]) * (p[1] - q[1])
+			+ (p[2] - q[2]) * (p[2] - q[2])
+		;
+		samples += 3;
+	}
+	free(copy);
+	free(pal);
+	
+	if (!sse)
+		return HUGE_VAL;
+	return 10 * log10(255.0 * 255.0 / (sse / samples));
+	
+L_fail:
+	free(copy);
+	free(pal);
+	return -1;
+}
+
+/* gives a texture without a format the one with the smallest tmem
+ * footprint whose psnr is at least `autoFormat` dB (the most faithful
+ * one if none are), and logs the decision to the docs
+ */
+static void *autoFormatTexture(struct objex_texture *tex, FILE *docs)
+{
+	extern float autoFormat;
+	static const struct autofmt candidates[] = {
+		{ N64TEXCONV_I, N64TEXCONV_4 }
+		, { N64TEXCONV_IA, N64TEXCONV_4 }
+		, { N64TEXCONV_CI, N64TEXCONV_4 }
+		, { N64TEXCONV_I, N64TEXCONV_8 }
+		, { N64TEXCONV_IA, N64TEXCONV_8 }
+		, { N64TEXCONV_CI, N64TEXCONV_8 }
+		, { N64TEXCONV_IA, N64TEXCONV_16 }
+		, { N64TEXCONV_RGBA, N64TEXCONV_16 }
+	};
+	const int num = sizeof(candidates) / sizeof(*candidates);
+	struct autofmt trial[sizeof(candidates) / sizeof(*candidates)];
+	struct autofmt *best = 0;
+	char name[16];
+	
+	if (autoFormat < 0
+		|| tex->format
+		|| tex->paletteSlot
+		|| tex->instead
+		|| tex->pointer
+		|| tex->aliasOf
+		|| !tex->pix
+	)
+		return success;
+	
+	if (parse_alphamode(tex->alphamode) >= N64TEXCONV_ACGEN_MAX)
+		return errmsg("texture '%s' unknown alphamode '%s'"
+			, tex->name, tex->alphamode
+		);
+	if (parse_dither(tex->dither) < 0)
+		return errmsg("texture '%s' unknown dither '%s'"
+			, tex->name, tex->dither
+		);
+	
+	memcpy(trial, candidates, sizeof(trial));
+	#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < num; ++i)
+	{
+		struct autofmt *t = &trial[i];
+		
+		t->psnr = -1;
+		if (n64texconv_min_size(&t->fmt, &t->bpp, tex->w, tex->h))
+			continue;
+		t->psnr = autofmt_psnr(tex, t->fmt, t->bpp, &t->footprint);
+		if (t->footprint > TMEM_MAX)
+			t->psnr = -1;
+	}
+	
+	/* smallest within the threshold */
+	for (int i = 0; i < num; ++i)
+	{
+		struct autofmt *t = &trial[i];
+		
+		if (t->psnr >= autoFormat
+			&& (!best
+				|| t->footprint < best->footprint
+				|| (t->footprint == best->footprint && t->psnr > best->psnr)
 			)
-			{
-				highest = tex->paletteSlot;
-				bpp = texture_textureBpp(tex);
-			}
-		}
+		)
+			best = t;
+	}
+	
+	/* most faithful otherwise */
+	for (int i = 0; i < num && !(best && best->psnr >= autoFormat); ++i)
+	{
+		struct autofmt *t = &trial[i];
 		
-		/* no more left to process */
-		if (!highest)
-			break;
-		/* previous highest, for next iteration */
-		prevHighest = highest;
-		slot = highest;
+		if (t->psnr >= 0 && (!best || t->psnr > best->psnr))
+			best = t;
+	}
+	
+	/* leave it to the usual heuristics */
+	if (!best)
+		return success;
+	
+	sprintf(name, "%s%s", fmtStr[best->fmt], bppStr[best->bpp]);
+	if (!(tex->format = strdup(name)))
+		return errmsg(ERR_NOMEM);
+	
+	if (docs)
+	{
+		fprintf(docs, "/* texture '%s': %s, %u bytes, ", tex->name, name, best->footprint);
+		if (isinf(best->psnr))
+			fprintf(docs, "lossless");
+		else
+			fprintf(docs, "psnr %.2f dB", best->psnr);
+		fprintf(docs, "%s */\n", (best->psnr < autoFormat) ? " (below threshold)" : "");
+	}
+	
+	return success;
+}
+
+/* picks formats for textures without one (see --auto-format) */
+void *texture_autoFormats(struct objex *obj)
+{
+	extern float autoFormat;
+	struct objex_texture *tex;
+	FILE *docs = getDocs(obj);
+	
+	if (autoFormat < 0)
+		return success;
+	
+	for (tex = obj->tex; tex; tex = tex->next)
+		if (!autoFormatTexture(tex, docs))
+			return errmsg(0);
+	
+	/* identical textures are converted the same way */
+	for (tex = obj->tex; tex; tex = tex->next)
+	{
+		struct objex_texture *src = tex->aliasOf;
 		
-//		debugf("shared slot %d\n", highest);
+		if (src && !tex->format && src->format
+			&& !(tex->format = strdup(src->format))
+		)
+			return errmsg(ERR_NOMEM);
+	}
+	
+	return success;
+}
+
+/* candidate for automatic palette sharing */
+struct autotex
+{
+	struct objex_texture *tex;
+	unsigned char *pix;    /* as texture_procSharedPalettes will see it */
+	uint16_t *colors;      /* unique visible colors (rgba5551), sorted */
+	int colorsNum;
+	int invisible;         /* unique invisible colors */
+	bool sharesInvisible;  /* black/white: one invisible color for all */
+	int bpp;
+	int dither;
+	double px;             /* visible pixels */
+	int next;              /* next texture in same cluster, -1 = end */
+};
+
+/* group of textures that will share one palette */
+struct autopal
+{
+	int head;              /* first texture, -1 = merged into another */
+	int bpp;
+	int invisible;
+	bool sharesInvisible;
+	uint16_t *colors;
+	int colorsNum;
+	int palColors;         /* colors in the palette, minus invisible */
+	double sse;            /* squared error of the shared palette */
+	double alone;          /* squared error of individual palettes */
+	double px;             /* visible pixels */
+};
+
+/* pairing of two clusters, as evaluated by autopal_pair() */
+struct autopair
+{
+	double cost;           /* added squared error; < 0 = not allowed */
+	double sse;
+	int colorsNum;
+};
+
+static int qsortfunc_u16(const void *a, const void *b)
+{
+	return *(const uint16_t*)a - *(const uint16_t*)b;
+}
+
+/* unique colors in two sorted lists of unique colors, optionally
+ * written to dst
+ */
+static int autopal_union(
+	const uint16_t *a
+	, int aNum
+	, const uint16_t *b
+	, int bNum
+	, uint16_t *dst
+)
+{
+	int num = 0;
+	
+	while (aNum || bNum)
+	{
+		uint16_t c;
 		
-	/* initialize a palette context */
-		/* derive max colors */
-		if (bpp == N64TEXCONV_4)
-			pal_max = 16;
+		if (!bNum || (aNum && *a < *b))
+			c = *a++, --aNum;
+		else if (!aNum || *b < *a)
+			c = *b++, --bNum;
 		else
+			c = *a++, --aNum, ++b, --bNum;
+		
+		if (dst)
+			dst[num] = c;
+		++num;
+	}
+	
+	return num;
+}
+
+/* squared color error of quantizing textures together the same way
+ * texture_procSharedPalettes does it; returns < 0 on failure
+ */
+static double autopal_error(
+	struct autotex *at
+	, int headA
+	, int headB
+	, int palMax
+	, int invisible
+)
+{
+	struct n64texconv_palctx *ctx;
+	unsigned char **copy;
+	int *member;
+	double sse = 0;
+	int num = 0;
+	int i;
+	int k;
+	
+	for (i = headA; i >= 0; i = at[i].next)
+		++num;
+	for (k = headB; k >= 0; k = at[k].next)
+		++num;
+	if (!(copy = calloc(num, sizeof(*copy)))
+		|| !(member = malloc(num * sizeof(*member)))
+	)
+	{
+		free(copy);
+		return -1;
+	}
+	
+	/* queue in objex order, as texture_procSharedPalettes would */
+	for (num = 0, i = headA, k = headB; i >= 0 || k >= 0; ++num)
+	{
+		int *from = (k < 0 || (i >= 0 && i < k)) ? &i : &k;
+		
+		member[num] = *from;
+		*from = at[*from].next;
+	}
+	ctx = n64texconv_palette_new(palMax, 0, calloc, realloc, free);
+	for (i = 0; i < num; ++i)
+	{
+		struct autotex *t = &at[member[i]];
+		int sz = t->tex->w * t->tex->h * 4;
+		
+		if (!(copy[i] = malloc(sz)))
 		{
-			bpp = N64TEXCONV_8;
-			pal_max = 256;
+			sse = -1;
+			break;
 		}
+		memcpy(copy[i], t->pix, sz);
+		n64texconv_palette_queue(ctx, copy[i], t->tex->w, t->tex->h, t->dither);
+	}
+	if (sse >= 0)
+	{
+		n64texconv_palette_alpha(ctx, invisible);
+		n64texconv_palette_exec(ctx);
+	}
+	n64texconv_palette_free(ctx);
+	
+	/* compare visible pixels, after rgba5551 conversion */
+	for (i = 0; i < num && sse >= 0; ++i)
+	{
+		struct autotex *t = &at[member[i]];
+		unsigned char *q = copy[i];
+		unsigned char *p = t->pix;
 		
-		if (!(palStruct = pushpal(obj, calloc, pal_max)))
+		n64texconv_to_n64_and_back(
+			q, 0, 0, N64TEXCONV_RGBA, N64TEXCONV_16, t->tex->w, t->tex->h
+		);
+		for (k = 0; k < t->tex->w * t->tex->h; ++k, p += 4, q += 4)
 		{
-			return errmsg(0);
+			if (!p[3])
+				continue;
+			sse += (p[0] - q[0]) * (p[0] - q[0])
+				+ (p[1] - q[1]) * (p[1] - q[1])
+				+ (p[2] - q[2]) * (p[2] - q[2])
+			;
 		}
-		pbuf = palStruct->colors;
+	}
+	
+	for (i = 0; i < num; ++i)
+		free(copy[i]);
+	free(member);
+	free(copy);
+	return sse;
+}
+
+/* evaluate sharing one palette between two clusters (b may be 0) */
+static struct autopair autopal_pair(
+	struct autotex *at
+	, struct autopal *a
+	, struct autopal *b
+	, float bound
+)
+{
+	struct autopair rv = { .cost = -1 };
+	int palMax = (a->bpp == N64TEXCONV_4) ? 16 : 256;
+	int invisible = a->invisible;
+	bool shares = a->sharesInvisible;
+	double px = a->px;
+	double alone = a->sse;
+	
+	if (b)
+	{
+		invisible += b->invisible;
+		shares |= b->sharesInvisible;
+		px += b->px;
+		alone += b->sse;
+		rv.colorsNum = autopal_union(
+			a->colors, a->colorsNum, b->colors, b->colorsNum, 0
+		);
 		
-		/* where colors will be stored */
-		pal = pbuf;
+		/* only one kind of invisible color accounting per palette */
+		if (shares && invisible)
+			return rv;
+	}
+	else
+		rv.colorsNum = a->colorsNum;
+	
+	invisible += shares;
+	if (invisible >= palMax / 2)
+		return rv;
+	
+	/* everything fits, so there is no loss */
+	if (rv.colorsNum + invisible <= palMax)
+	{
+		rv.cost = 0;
+		rv.sse = 0;
+		return rv;
+	}
+	if (b && bound <= 0)
+		return rv;
+	
+	rv.sse = autopal_error(at, a->head, b ? b->head : -1, palMax, invisible);
+	rv.colorsNum = palMax - invisible;
+	if (rv.sse < 0)
+		return rv;
+	if (b && sqrt(rv.sse / (px * 3)) > bound)
+		return rv;
+	rv.cost = rv.sse - alone;
+	if (rv.cost < 0)
+		rv.cost = 0;
+	
+	return rv;
+}
+
+/* groups color-indexed textures without a palette slot into shared
+ * palettes, as long as each palette stays within `autoPalettes` rms
+ * color error (0 = only when no colors are lost); the groups are then
+ * given slots for texture_procSharedPalettes to process
+ */
+void *texture_clusterPalettes(struct objex *obj)
+{
+	extern float autoPalettes;
+	struct objex_texture *tex;
+	struct autotex *at = 0;
+	struct autopal *ap = 0;
+	struct autopair *pair = 0;
+	int (*todo)[2] = 0;
+	int todoNum = 0;
+	FILE *docs = getDocs(obj);
+	void *rv = success;
+	int slot = 0;
+	int num = 0;
+	int i;
+	int k;
+	
+	if (autoPalettes < 0)
+		return success;
+	
+	/* palettes shared across files aren't supported */
+	if (obj->fileNum > 1)
+		return success;
+	
+	for (tex = obj->tex; tex; tex = tex->next)
+	{
+		if (tex->paletteSlot > slot)
+			slot = tex->paletteSlot;
+		++num;
+	}
+	if (!num)
+		return success;
+	if (!(at = calloc(num, sizeof(*at))))
+		return errmsg(ERR_NOMEM);
+	
+	/* gather candidates */
+	num = 0;
+	for (tex = obj->tex; tex; tex = tex->next)
+	{
+		enum n64texconv_fmt fmt;
+		enum n64texconv_bpp bpp;
+		enum n64texconv_acgen acfunc = parse_alphamode(tex->alphamode);
+		int dither = parse_dither(tex->dither);
+		struct autotex *t = &at[num];
+		int palMax;
+		int n;
 		
-		/* allocate palette context */
-		pctx = n64texconv_palette_new(
-			pal_max
-			, pal
+		if (tex->paletteSlot
+			|| tex->instead
+			|| tex->pointer
+			|| tex->aliasOf
+			|| !tex->pix
+			|| !tex->isUsed
+			|| tex->alwaysUnused
+			|| acfunc >= N64TEXCONV_ACGEN_MAX
+			|| dither < 0
+		)
+			continue;
+		
+		if (!resolveFmtBpp(tex, &fmt, &bpp))
+		{
+			rv = errmsg(0);
+			goto L_done;
+		}
+		if (fmt != N64TEXCONV_CI
+			|| (tex->format && texture_textureBpp(tex) != bpp)
+		)
+			continue;
+		
+		/* shared palettes are always loaded in full */
+		palMax = (bpp == N64TEXCONV_4) ? 16 : 256;
+		n = tex->w * tex->h;
+		if (((n << bpp) >> 1) + palMax * 2 > TMEM_MAX)
+			continue;
+		
+		/* prepare it the way texture_procSharedPalettes will */
+		if (!(t->pix = malloc(n * 4)) || !(t->colors = malloc(n * 2)))
+		{
+			rv = errmsg(ERR_NOMEM);
+			++num;
+			goto L_done;
+		}
+		memcpy(t->pix, tex->pix, n * 4);
+		n64texconv_to_n64_and_back(
+			t->pix, 0, 0, N64TEXCONV_RGBA, N64TEXCONV_16, tex->w, tex->h
+		);
+		t->invisible = n64texconv_acgen(
+			t->pix
+			, tex->w
+			, tex->h
+			, acfunc
+			, acfunc_colors
 			, calloc
 			, realloc
 			, free
+			, N64TEXCONV_CI
 		);
+		if (t->invisible < 0)
+		{
+			free(t->pix);
+			free(t->colors);
+			memset(t, 0, sizeof(*t));
+			continue;
+		}
+		if (t->invisible
+			&& (acfunc == N64TEXCONV_ACGEN_BLACK
+				|| acfunc == N64TEXCONV_ACGEN_WHITE
+			)
+		)
+		{
+			t->sharesInvisible = true;
+			t->invisible = 0;
+		}
 		
-		/* register textures into palette */
-		for (tex = obj->tex; tex; tex = tex->next)
+		/* unique visible colors */
+		for (i = 0; i < n; ++i)
 		{
-			int num_invisible;
-			void *png = tex->pix;
-			int w = tex->w;
-			int h = tex->h;
-			enum n64texconv_acgen acfunc = parse_alphamode(tex->alphamode);
-			if (acfunc >= N64TEXCONV_ACGEN_MAX)
-				return errmsg("texture '%s' unknown alphamode '%s'"
-					, tex->name, tex->alphamode
-				);
+			unsigned char *p = t->pix + i * 4;
 			
-			if (tex->paletteSlot != slot)
+			if (!p[3])
 				continue;
+			t->colors[t->colorsNum++] =
+				((p[0] >> 3) << 11) | ((p[1] >> 3) << 6) | ((p[2] >> 3) << 1) | 1
+			;
+			t->px += 1;
+		}
+		qsort(t->colors, t->colorsNum, sizeof(*t->colors), qsortfunc_u16);
+		for (i = k = 0; i < t->colorsNum; ++i)
+			if (!k || t->colors[k - 1] != t->colors[i])
+				t->colors[k++] = t->colors[i];
+		t->colorsNum = k;
+		
+		t->tex = tex;
+		t->bpp = bpp;
+		t->dither = dither;
+		t->next = -1;
+		++num;
+	}
+	if (num < 2)
+		goto L_done;
+	
+	/* every candidate starts out with a palette of its own */
+	if (!(ap = calloc(num, sizeof(*ap)))
+		|| !(pair = calloc(num * num, sizeof(*pair)))
+		|| !(todo = calloc(num * num, sizeof(*todo)))
+	)
+	{
+		rv = errmsg(ERR_NOMEM);
+		goto L_done;
+	}
+	for (i = 0; i < num; ++i)
+	{
+		struct autotex *t = &at[i];
+		struct autopal *a = &ap[i];
+		
+		a->head = i;
+		a->bpp = t->bpp;
+		a->invisible = t->invisible;
+		a->sharesInvisible = t->sharesInvisible;
+		a->colors = t->colors;
+		a->colorsNum = t->colorsNum;
+		a->palColors = t->colorsNum;
+		a->px = t->px;
+	}
+	#pragma omp parallel for schedule(dynamic)
+	for (i = 0; i < num; ++i)
+	{
+		struct autopair alone = autopal_pair(at, &ap[i], 0, autoPalettes);
+		
+		ap[i].sse = ap[i].alone = (alone.cost < 0) ? 0 : alone.sse;
+	}
+	
+	/* every pairing of palettes of the same bit depth */
+	for (i = 0; i < num; ++i)
+		for (k = i + 1; k < num; ++k)
+			if (ap[i].bpp == ap[k].bpp)
+				todo[todoNum][0] = i, todo[todoNum++][1] = k;
+	
+	/* merge the cheapest pairing until none are left */
+	while (todoNum)
+	{
+		struct autopal *a;
+		struct autopal *b;
+		struct autopair *best = 0;
+		uint16_t *colors;
+		int bestA = 0;
+		int bestB = 0;
+		
+		#pragma omp parallel for schedule(dynamic)
+		for (int j = 0; j < todoNum; ++j)
+		{
+			int ia = todo[j][0];
+			int ib = todo[j][1];
 			
-			if (texture_textureBpp(tex) != bpp)
+			pair[ia * num + ib] = autopal_pair(at, &ap[ia], &ap[ib], autoPalettes);
+		}
+		
+		for (i = 0; i < num; ++i)
+		{
+			if (ap[i].head < 0)
+				continue;
+			for (k = i + 1; k < num; ++k)
 			{
-				return errmsg("palette slot %d: mixed formats", slot);
-//				debugf("palette slot %d: mixed formats", slot);
-//				exit(EXIT_FAILURE);
+				struct autopair *p = &pair[i * num + k];
+				
+				if (ap[k].head < 0 || ap[k].bpp != ap[i].bpp || p->cost < 0)
+					continue;
+				if (!best
+					|| p->cost < best->cost
+					|| (p->cost == best->cost && p->colorsNum < best->colorsNum)
+				)
+				{
+					best = p;
+					bestA = i;
+					bestB = k;
+				}
 			}
+		}
+		if (!best)
+			break;
+		
+		/* b joins a */
+		a = &ap[bestA];
+		b = &ap[bestB];
+		if (!(colors = malloc((a->colorsNum + b->colorsNum) * 2)))
+		{
+			rv = errmsg(ERR_NOMEM);
+			goto L_done;
+		}
+		a->colorsNum = autopal_union(
+			a->colors, a->colorsNum, b->colors, b->colorsNum, colors
+		);
+		if (a->colors != at[bestA].colors)
+			free(a->colors);
+		a->colors = colors;
+		a->invisible += b->invisible;
+		a->sharesInvisible |= b->sharesInvisible;
+		a->palColors = best->colorsNum;
+		a->sse = best->sse;
+		a->alone += b->alone;
+		a->px += b->px;
+		
+		/* texture list stays in objex order */
+		{
+			int *w = &a->head;
+			int ia = a->head;
+			int ib = b->head;
 			
-			/* we need this for later */
-			tex->palette = palStruct;
-			if (tex->isUsed)
-				palStruct->isUsed = 1;
-			
-			/* link data into list */
-			struct list *item = malloc(sizeof(*item));
-			item->udata = tex;
-			item->next = rme;
-			item->data = png;
-			item->fn   = 0;//name;
-			item->w    = w;
-			item->h    = h;
-			rme = item;
-			
-			/* simplify colors first */
-			/* rgba8888 -> rgba5551 -> rgba8888 */
-			n64texconv_to_n64_and_back(
-				png /* in-place conversion */
-				, 0
-				, 0
-				, N64TEXCONV_RGBA
-				, N64TEXCONV_16
-				, w
-				, h
-			);
-			
-			/* generate alpha pixel colors */
-			num_invisible =
-			n64texconv_acgen(
-				png
-				, w
-				, h
-				, acfunc
-				, acfunc_colors
-				, calloc
-				, realloc
-				, free
-				, fmt
+			while (ia >= 0 || ib >= 0)
+			{
+				int *from = (ib < 0 || (ia >= 0 && ia < ib)) ? &ia : &ib;
+				
+				*w = *from;
+				w = &at[*from].next;
+				*from = at[*from].next;
+			}
+			*w = -1;
+		}
+		b->head = -1;
+		
+		/* only pairings with the grown palette need another look */
+		todoNum = 0;
+		for (k = 0; k < num; ++k)
+			if (k != bestA && ap[k].head >= 0 && ap[k].bpp == a->bpp)
+			{
+				todo[todoNum][0] = (k < bestA) ? k : bestA;
+				todo[todoNum++][1] = (k < bestA) ? bestA : k;
+			}
+	}
+	
+	/* give every group a palette slot of its own */
+	for (i = 0; i < num; ++i)
+	{
+		struct autopal *a = &ap[i];
+		const char *fmtName = (a->bpp == N64TEXCONV_4) ? "ci4" : "ci8";
+		
+		if (a->head < 0 || at[a->head].next < 0)
+			continue;
+		
+		++slot;
+		if (docs)
+			fprintf(docs
+				, "/* palette slot %d (%s): %d colors, rms error %.2f"
+				" (%.2f unshared)\n *"
+				, slot
+				, fmtName
+				, a->palColors + a->invisible + a->sharesInvisible
+				, sqrt(a->sse / (a->px * 3))
+				, sqrt(a->alone / (a->px * 3))
 			);
-			
-			/* white/black means only one invisible pixel    *
-			 * color is shared across all converted textures */
-			if (num_invisible &&
-				(
-					acfunc == N64TEXCONV_ACGEN_BLACK
-					|| acfunc == N64TEXCONV_ACGEN_WHITE
-				)
-			)
-				total_invisible = 1;
-			/* otherwise, each has unique invisible pixel(s) */
-			else
-				total_invisible += num_invisible;
-			
-			if (num_invisible < 0 || total_invisible >= (pal_max/2))
+		for (k = a->head; k >= 0; k = at[k].next)
+		{
+			tex = at[k].tex;
+			tex->paletteSlot = slot;
+			if (!tex->format && !(tex->format = strdup(fmtName)))
 			{
-				return errmsg(
-					"ran out of alpha colors "
-					"(change alpha color mode or use fewer textures)"
-				);
+				rv = errmsg(ERR_NOMEM);
+				goto L_done;
 			}
-			
-			/* add image to queue */
-			n64texconv_palette_queue(pctx, png, w, h, 0);
-			
-//			debugf("  %s (%s)\n", tex->name, tex->filename);
+			if (docs)
+				fprintf(docs, " '%s'", tex->name);
 		}
+		if (docs)
+			fprintf(docs, "\n */\n");
+	}
+	
+L_done:
+	for (i = 0; i < num; ++i)
+	{
+		if (ap && ap[i].colors != at[i].colors)
+			free(ap[i].colors);
+		free(at[i].colors);
+		free(at[i].pix);
+	}
+	free(todo);
+	free(pair);
+	free(ap);
+	free(at);
+	return rv;
+}
+
+/* texture within a palette slot, and where it is in the objex */
+struct slottex
+{
+	struct objex_texture *tex;
+	int order;
+};
+
+/* one palette slot for texture_procSharedPalettes to process */
+struct slotjob
+{
+	struct objex_palette *pal;
+	struct slottex *member;  /* in objex order */
+	int memberNum;
+	int slot;
+	int bpp;
+	const char *err;         /* static error message, if any */
+};
+
+/* by slot (highest first), then objex order */
+static int qsortfunc_slottex(const void *a, const void *b)
+{
+	const struct slottex *x = a;
+	const struct slottex *y = b;
+	
+	if (x->tex->paletteSlot != y->tex->paletteSlot)
+		return y->tex->paletteSlot - x->tex->paletteSlot;
+	return x->order - y->order;
+}
+
+/* quantize the textures of one slot together and convert them */
+static void procSlot(struct slotjob *job)
+{
+	const int fmt = N64TEXCONV_CI;
+	const int bpp = job->bpp;
+	const int pal_max = (bpp == N64TEXCONV_4) ? 16 : 256;
+	void *pal = job->pal->colors;
+	struct n64texconv_palctx *pctx;
+	struct list *rme = 0;
+	struct list *next;
+	int total_invisible = 0;
+	int pal_colors;
+	unsigned int pal_bytes;
+	
+	/* allocate palette context */
+	pctx = n64texconv_palette_new(
+		pal_max
+		, pal
+		, calloc
+		, realloc
+		, free
+	);
+	
+	/* register textures into palette */
+	for (int i = 0; i < job->memberNum; ++i)
+	{
+		struct objex_texture *tex = job->member[i].tex;
+		int num_invisible;
+		void *png = tex->pix;
+		int w = tex->w;
+		int h = tex->h;
+		enum n64texconv_acgen acfunc = parse_alphamode(tex->alphamode);
+		int dither = parse_dither(tex->dither);
+		
+		if (tex->aliasOf)
+			continue;
+		
+		/* link data into list */
+		struct list *item = malloc(sizeof(*item));
+		if (!item)
+		{
+			job->err = ERR_NOMEM;
+			break;
+		}
+		item->udata = tex;
+		item->next = rme;
+		item->data = png;
+		item->fn   = 0;//name;
+		item->w    = w;
+		item->h    = h;
+		rme = item;
+		
+		/* simplify colors first */
+		/* rgba8888 -> rgba5551 -> rgba8888 */
+		n64texconv_to_n64_and_back(
+			png /* in-place conversion */
+			, 0
+			, 0
+			, N64TEXCONV_RGBA
+			, N64TEXCONV_16
+			, w
+			, h
+		);
+		
+		/* generate alpha pixel colors */
+		num_invisible =
+		n64texconv_acgen(
+			png
+			, w
+			, h
+			, acfunc
+			, acfunc_colors
+			, calloc
+			, realloc
+			, free
+			, fmt
+		);
+		
+		/* white/black means only one invisible pixel    *
+		 * color is shared across all converted textures */
+		if (num_invisible &&
+			(
+				acfunc == N64TEXCONV_ACGEN_BLACK
+				|| acfunc == N64TEXCONV_ACGEN_WHITE
+			)
+		)
+			total_invisible = 1;
+		/* otherwise, each has unique invisible pixel(s) */
+		else
+			total_invisible += num_invisible;
 		
+		if (num_invisible < 0 || total_invisible >= (pal_max/2))
+		{
+			job->err =
+				"ran out of alpha colors "
+				"(change alpha color mode or use fewer textures)"
+			;
+			break;
+		}
+		
+		/* add image to queue */
+		n64texconv_palette_queue(pctx, png, w, h, dither);
+	}
+	
+	if (!job->err)
+	{
 		/* quantize images */
-//		debugf("invisible = %d\n", total_invisible);
 		n64texconv_palette_alpha(pctx, total_invisible);
 		pal_colors = n64texconv_palette_exec(pctx);
-					
+		
 		/* convert palette colors (rgba8888 -> rgba5551) */
 		n64texconv_to_n64(
 			pal /* in-place conversion */
@@ -587,6 +1853,9 @@ void *texture_procSharedPalettes(struct objex *obj)
 		/* convert every texture */
 		for (struct list *item = rme; item; item = item->next)
 		{
+			struct objex_texture *tex = item->udata;
+			struct texUdata *udata = tex->udata;
+			
 			n64texconv_to_n64(
 				item->data /* in-place conversion */
 				, item->data
@@ -598,10 +1867,6 @@ void *texture_procSharedPalettes(struct objex *obj)
 				, item->h
 				, &item->sz
 			);
-			struct objex_texture *tex = item->udata;
-			struct texUdata *udata = tex->udata;
-			if (!udata)
-				return errmsg("texture '%s' not loaded", tex->name);
 			udata->fileSz = item->sz;
 			
 			udata->gbiFmtStr = gbiFmtStr[fmt];
@@ -613,21 +1878,141 @@ void *texture_procSharedPalettes(struct objex *obj)
 		/* NOTE: pal_colors is important here, not pal_max! */
 		watermark(pal, pal_bytes, pal_colors, rme);
 		
-		/* free n64texconv palette context */
-		n64texconv_palette_free(pctx);
+		/* end of zztexview stuff */
+		job->pal->colorsSize = pal_bytes;
+		job->pal->colorsNum = pal_colors;
+	}
+	
+	/* free n64texconv palette context */
+	n64texconv_palette_free(pctx);
+	
+	/* free all the rme items */
+	for (struct list *item = rme; item; item = next)
+	{
+		next = item->next;
+		if (!job->err)
+			shrinkPix(item->udata);
+		free(item);
+	}
+}
+
+/* process textures sharing palette slots; textures are grouped by
+ * slot in one pass, palettes are created highest slot first, and
+ * the slots are then quantized and converted in parallel
+ */
+void *texture_procSharedPalettes(struct objex *obj)
+{
+	struct objex_texture *tex;
+	struct slottex *st = 0;
+	struct slotjob *job = 0;
+	void *rv = success;
+	int stNum = 0;
+	int jobNum = 0;
+	int i;
+	
+	for (tex = obj->tex; tex; tex = tex->next)
+		stNum += tex->paletteSlot > 0;
+	if (!stNum)
+		return success;
+	
+	/* every texture is checked once any slot exists */
+	for (tex = obj->tex; tex; tex = tex->next)
+	{
+		if (parse_alphamode(tex->alphamode) >= N64TEXCONV_ACGEN_MAX)
+			return errmsg("texture '%s' unknown alphamode '%s'"
+				, tex->name, tex->alphamode
+			);
+		if (parse_dither(tex->dither) < 0)
+			return errmsg("texture '%s' unknown dither '%s'"
+				, tex->name, tex->dither
+			);
+	}
+	
+	/* bucket textures by slot */
+	if (!(st = malloc(stNum * sizeof(*st)))
+		|| !(job = calloc(stNum, sizeof(*job)))
+	)
+	{
+		rv = errmsg(ERR_NOMEM);
+		goto L_done;
+	}
+	for (i = 0, stNum = 0, tex = obj->tex; tex; tex = tex->next, ++i)
+	{
+		if (tex->paletteSlot > 0)
+		{
+			st[stNum].tex = tex;
+			st[stNum++].order = i;
+		}
+	}
+	qsort(st, stNum, sizeof(*st), qsortfunc_slottex);
+	
+	for (i = 0; i < stNum; ++i)
+	{
+		struct slotjob *j = jobNum ? &job[jobNum - 1] : 0;
 		
-		/* free all the rme items */
-		for (struct list *item = rme; item; item = next)
+		tex = st[i].tex;
+		
+		/* first texture of a new slot decides its bit depth */
+		if (!j || tex->paletteSlot != j->slot)
 		{
-			next = item->next;
-			free(item);
+			int pal_max;
+			
+			j = &job[jobNum++];
+			j->slot = tex->paletteSlot;
+			j->bpp = texture_textureBpp(tex);
+			j->member = &st[i];
+			
+			/* derive max colors */
+			if (j->bpp == N64TEXCONV_4)
+				pal_max = 16;
+			else
+			{
+				j->bpp = N64TEXCONV_8;
+				pal_max = 256;
+			}
+			
+			/* created in slot order, so the output doesn't change */
+			if (!(j->pal = pushpal(obj, calloc, pal_max)))
+			{
+				rv = errmsg(0);
+				goto L_done;
+			}
 		}
+		++j->memberNum;
 		
-		/* end of zztexview stuff */
-		palStruct->colorsSize = pal_bytes;
-		palStruct->colorsNum = pal_colors;
+		if (tex->aliasOf)
+			continue;
+		
+		if (texture_textureBpp(tex) != j->bpp)
+		{
+			rv = errmsg("palette slot %d: mixed formats", j->slot);
+			goto L_done;
+		}
+		
+		/* we need this for later */
+		tex->palette = j->pal;
+		if (tex->isUsed)
+			j->pal->isUsed = 1;
 	}
-	return success;
+	
+	/* slots don't share any data, so they can be done at once */
+	#pragma omp parallel for schedule(dynamic)
+	for (i = 0; i < jobNum; ++i)
+		procSlot(&job[i]);
+	
+	for (i = 0; i < jobNum; ++i)
+	{
+		if (job[i].err)
+		{
+			rv = errmsg("%s", job[i].err);
+			goto L_done;
+		}
+	}
+	
+L_done:
+	free(job);
+	free(st);
+	return rv;
 }
 
 void *texture_procTexture(struct objex_texture *tex)
@@ -646,72 +2031,44 @@ void *texture_procTexture(struct objex_texture *tex)
 	int palColors = 0;
 	int do_watermark = 0;
 	
-#undef fail
-#define fail(...) {                    \
-   errmsg(__VA_ARGS__);                \
-   return 0;                           \
-}
-	
-	if (!tex || (udata && udata->fileSz))
-		return success;
-	
-	/* texture already loaded */
-	png = tex->pix;
-	
-	if (!png || !udata)
-		return errmsg("texture '%s' not loaded", tex->name);
-	
-	/* custom format string */
-	if (tex->format)
-	{
-		if (!getFmtBpp(tex, &fmt, &bpp))
-			return errmsg(0);
-	}
-	else if (tex->paletteSlot || tex->instead)
-	{
-		/* palette slots without a format
-		 * specified default to ci8
-		 */
-		fmt = N64TEXCONV_CI;
-		bpp = N64TEXCONV_8;
-	}
-	else
-	{
-		/* format must be specified if texture pointer override
-		 * (except when texture bank (tex->instead) is specified) */
-		if (tex->pointer && !tex->format)
-			fail(
-				"'%s': format must be specified for texture %08X"
-				, tex->filename
-				, tex->pointer
-			);
-		/* no format specified, so let's try for the best */
-		if ((errstr = n64texconv_best_format(png, &fmt, &bpp, w, h)))
-			fail("'%s' conversion error: %s", tex->filename, errstr);
-		/* fall back to rgba16 if rgba32 */
-		if (bpp == N64TEXCONV_32)
-			bpp = N64TEXCONV_16;
-		/* force ci8 on rgba16 */
-		if (fmt == N64TEXCONV_RGBA && bpp == N64TEXCONV_16)
-		{
-			fmt = N64TEXCONV_CI;
-			bpp = N64TEXCONV_8;
-		}
-	}
-	/* yuv, sneaky zelda fans */
-	if (fmt == N64TEXCONV_YUV)
-		fail("yuv is not supported");
-	if (tex->paletteSlot && fmt != N64TEXCONV_CI)
-		fail("texture '%s' palette slot %d but format == '%s'"
-			, tex->name, tex->paletteSlot, fmtStr[fmt]
-		);
-	
-	/* ensure minimum size magic */
-	{const char *x = n64texconv_min_size(&fmt, &bpp, w, h);
-	if (x)
-		fail("texture '%s' conversion error: %s", tex->name, x);
+#undef fail
+#define fail(...) {                    \
+   errmsg(__VA_ARGS__);                \
+   return 0;                           \
+}
+	
+	if (!tex)
+		return success;
+	
+	/* shares the conversion of an identical texture */
+	if (tex->aliasOf)
+	{
+		struct objex_texture *src = tex->aliasOf;
+		struct texUdata *srcUdata = src->udata;
+		
+		udata->fileSz = srcUdata->fileSz;
+		udata->gbiFmtStr = srcUdata->gbiFmtStr;
+		udata->gbiBppStr = srcUdata->gbiBppStr;
+		udata->gbiBpp = srcUdata->gbiBpp;
+		tex->sz = src->sz;
+		tex->fmt = src->fmt;
+		tex->bpp = src->bpp;
+		
+		return success;
 	}
 	
+	if (udata && udata->fileSz)
+		return success;
+	
+	/* texture already loaded */
+	png = tex->pix;
+	
+	if (!png || !udata)
+		return errmsg("texture '%s' not loaded", tex->name);
+	
+	if (!resolveFmtBpp(tex, &fmt, &bpp))
+		return errmsg(0);
+	
 	/* texture already has a palette and has already been converted */
 	if (tex->palette)
 	{
@@ -727,6 +2084,7 @@ void *texture_procTexture(struct objex_texture *tex)
 		int num_invisible;
 		unsigned int pal_bytes = 0;
 		enum n64texconv_acgen acfunc;
+		int dither = parse_dither(tex->dither);
 		
 		/* default alphamode will be `image` for `i` */
 		if (fmt == N64TEXCONV_I && !tex->alphamode)
@@ -739,18 +2097,26 @@ void *texture_procTexture(struct objex_texture *tex)
 			return errmsg("texture '%s' unknown alphamode '%s'"
 				, tex->name, tex->alphamode
 			);
-		num_invisible =
-		n64texconv_acgen(
-			png
-			, w
-			, h
-			, acfunc
-			, acfunc_colors
-			, calloc
-			, realloc
-			, free
-			, fmt
-		);
+		if (dither < 0)
+			return errmsg("texture '%s' unknown dither '%s'"
+				, tex->name, tex->dither
+			);
+		/* gray (+ alpha) data was checked not to need this on load */
+		if (udata->pixChannels == 4)
+			num_invisible =
+			n64texconv_acgen(
+				png
+				, w
+				, h
+				, acfunc
+				, acfunc_colors
+				, calloc
+				, realloc
+				, free
+				, fmt
+			);
+		else
+			num_invisible = 0;
 		
 		if (fmt == N64TEXCONV_CI)
 		{
@@ -771,7 +2137,7 @@ void *texture_procTexture(struct objex_texture *tex)
 				, w
 				, h
 				, pal_max - num_invisible
-				, 0
+				, dither
 				, calloc
 				, realloc
 				, free
@@ -799,7 +2165,19 @@ void *texture_procTexture(struct objex_texture *tex)
 		}
 		
 		/* convert texture */
-		if ((errstr = n64texconv_to_n64(
+		if (udata->pixChannels != 4)
+			errstr = n64texconv_gray_to_n64(
+				png /* in-place conversion */
+				, png
+				, udata->pixChannels
+				, fmt
+				, bpp
+				, w
+				, h
+				, &sz
+			);
+		else
+			errstr = n64texconv_to_n64(
 				png /* in-place conversion */
 				, png
 				, pal
@@ -809,8 +2187,9 @@ void *texture_procTexture(struct objex_texture *tex)
 				, w
 				, h
 				, &sz
-			))
-		)	fail("texture '%s' conversion error: %s", tex->name, errstr);
+			);
+		if (errstr)
+			fail("texture '%s' conversion error: %s", tex->name, errstr);
 		
 		/* complain when TMEM is exceeded */
 		if (sz + pal_bytes > TMEM_MAX
@@ -838,6 +2217,7 @@ void *texture_procTexture(struct objex_texture *tex)
 		}
 		
 		udata->fileSz = sz;
+		shrinkPix(tex);
 		
 		udata->gbiFmtStr = gbiFmtStr[fmt];
 		udata->gbiBppStr = gbiBppStr[bpp];
@@ -868,6 +2248,170 @@ void *texture_procTextures(struct objex *obj)
 	return success;
 }
 
+/* keeps the textures loaded so far (those before `end`) within
+ * `maxMemory` MiB, first by converting the ones that don't depend
+ * on others early, then by spilling converted data to disk; those
+ * sharing palettes (slots, --auto-palettes) wait for their stage
+ */
+static void *relieveMemory(struct objex *obj, struct objex_texture *end)
+{
+	extern int maxMemory;
+	extern float autoPalettes;
+	uint64_t budget = (uint64_t)maxMemory << 20; /* past 4 GiB on win32 */
+	struct objex_texture *tex;
+	FILE *docs = getDocs(obj);
+	uint64_t total = 0;
+	
+	if (!maxMemory)
+		return success;
+	
+	for (tex = obj->tex; tex != end; tex = tex->next)
+		total += pixBytes(tex);
+	
+	/* convert what can be converted on its own */
+	for (tex = obj->tex; tex != end && total > budget; tex = tex->next)
+	{
+		struct texUdata *udata = tex->udata;
+		size_t before = pixBytes(tex);
+		
+		if (!tex->pix
+			|| udata->fileSz
+			|| tex->paletteSlot
+			|| autoPalettes >= 0
+		)
+			continue;
+		
+		if (!autoFormatTexture(tex, docs)
+			|| !texture_procTexture(tex)
+		)
+			return errmsg(0);
+		total -= before - pixBytes(tex);
+	}
+	
+	/* then set converted data aside */
+	for (tex = obj->tex; tex != end && total > budget; tex = tex->next)
+	{
+		struct texUdata *udata = tex->udata;
+		
+		if (!tex->pix || !udata->fileSz)
+			continue;
+		
+		total -= pixBytes(tex);
+		if (!spillPix(tex))
+			return errmsg(0);
+	}
+	
+	return success;
+}
+
+/* whether a texture is drawn by a material that can use an atlas */
+static bool atlas_isWanted(struct objex *obj, struct objex_texture *tex)
+{
+	for (struct objex_material *mtl = obj->mtl; mtl; mtl = mtl->next)
+	{
+		struct objex_texture *tex0 = mtl->tex0;
+		
+		if (tex0 && tex0->aliasOf)
+			tex0 = tex0->aliasOf;
+		
+		if (tex0 == tex
+			&& !mtl->tex1
+			&& mtl->isUsed
+			&& mtl->gbi
+			&& strstr(mtl->gbi, "_loadtexels")
+		)
+			return true;
+	}
+	
+	return false;
+}
+
+/* stacks small textures of the same format, palette, and width into
+ * atlases that get written in one piece and loaded into TMEM at once;
+ * each texture is then drawn from its own offset within TMEM, so
+ * texture coordinates and wrapping stay as they are
+ * NOTE this should be called after textures have been processed
+ */
+void *texture_buildAtlases(struct objex *obj)
+{
+	extern int atlasTextures;
+	struct objex_texture *tex;
+	
+	if (!atlasTextures)
+		return success;
+	
+	/* textures are divided between files later on */
+	if (obj->fileNum > 1)
+		return success;
+	
+	bool isCandidate(struct objex_texture *tex)
+	{
+		struct texUdata *udata = tex->udata;
+		int bits;
+		
+		if (!udata
+			|| !tex->isUsed
+			|| tex->alwaysUnused
+			|| tex->aliasOf
+			|| tex->commonRef
+			|| tex->pointer
+			|| tex->instead
+			|| udata->virtDiv != 1
+			|| udata->uvMult.w != 1
+			|| udata->uvMult.h != 1
+			|| udata->atlas
+		)
+			return false;
+		
+		/* one block load; lines must be whole power-of-two words,
+		 * and textures must start on even lines of the atlas
+		 */
+		bits = 4 << udata->gbiBpp;
+		if (udata->gbiBpp == N64TEXCONV_32
+			|| (tex->w * bits) % 64
+			|| (tex->w & (tex->w - 1))
+			|| (tex->h & 1)
+		)
+			return false;
+		
+		return atlas_isWanted(obj, tex);
+	}
+	
+	for (tex = obj->tex; tex; tex = tex->next)
+	{
+		struct texUdata *udata = tex->udata;
+		struct objex_texture *last = tex;
+		struct objex_texture *other;
+		unsigned int max = tex->palette ? TMEM_MAX / 2 : TMEM_MAX;
+		unsigned int sz = udata ? udata->fileSz : 0;
+		
+		if (!isCandidate(tex) || sz > max)
+			continue;
+		
+		for (other = tex->next; other; other = other->next)
+		{
+			struct texUdata *o = other->udata;
+			
+			if (!isCandidate(other)
+				|| other->palette != tex->palette
+				|| other->w != tex->w
+				|| o->gbiBpp != udata->gbiBpp
+				|| strcmp(o->gbiFmtStr, udata->gbiFmtStr)
+				|| sz + o->fileSz > max
+			)
+				continue;
+			
+			sz += o->fileSz;
+			udata->atlas = tex;
+			o->atlas = tex;
+			((struct texUdata*)last->udata)->atlasNext = other;
+			last = other;
+		}
+	}
+	
+	return success;
+}
+
 void *texture_writeTexture(VFILE *bin, struct objex_texture *tex)
 {
 	FILE *docs;
@@ -883,6 +2427,10 @@ void *texture_writeTexture(VFILE *bin, struct objex_texture *tex)
 		return success;
 	}
 	
+	/* written by the texture it is identical to */
+	if (tex->aliasOf)
+		return success;
+	
 	if (!(docs = getDocs(tex->objex)))
 		return 0;
 	
@@ -896,9 +2444,8 @@ void *texture_writeTexture(VFILE *bin, struct objex_texture *tex)
 	
 	struct objexUdata *oudat = tex->objex->udata;
 	struct texUdata *udata = tex->udata;
-	unsigned char *png8 = tex->pix;
 	
-	if (!udata || !png8)
+	if (!udata || (!tex->pix && !udata->isSpilled))
 		return errmsg("uninitialized texture '%s'", tex->name);
 	
 	/* get texture offset */
@@ -954,7 +2501,15 @@ void *texture_writeTexture(VFILE *bin, struct objex_texture *tex)
 	}
 	
 	/* write texture into file */
-	vfwrite(png8, 1, udata->fileSz, bin);
+	{
+		void *tmp;
+		const void *png8 = texData(tex, &tmp);
+		
+		if (!png8)
+			return errmsg(0);
+		vfwrite(png8, 1, udata->fileSz, bin);
+		free(tmp);
+	}
 //	for (int i = 0; i < udata->fileSz; ++i)
 //		vfput8(bin, png8[i]);
 	
@@ -969,10 +2524,64 @@ void *texture_writeTextures(VFILE *bin, struct objex *obj)
 	
 	for (tex = obj->tex; tex; tex = tex->next)
 	{
+		struct texUdata *udata = tex->udata;
+		
+		/* atlases are written in one piece, by their first texture */
+		if (udata && udata->atlas)
+		{
+			struct objex_texture *t;
+			int num = 0;
+			
+			if (udata->atlas != tex)
+				continue;
+			
+			udata->atlasFileOfs = vftell(bin);
+			udata->atlasH = 0;
+			for (t = tex; t; t = ((struct texUdata*)t->udata)->atlasNext)
+			{
+				struct texUdata *tu = t->udata;
+				
+				if (!texture_writeTexture(bin, t))
+					return errmsg(0);
+				
+				/* unused ones don't get written */
+				if (!t->isUsed)
+					continue;
+				tu->atlasOfs = tu->fileOfs - udata->atlasFileOfs;
+				udata->atlasH += t->h;
+				++num;
+			}
+			
+			/* not worth loading as one */
+			if (num < 2)
+				udata->atlasH = 0;
+			continue;
+		}
+		
 		if (!texture_writeTexture(bin, tex))
 			return errmsg(0);
 	}
 	
+	/* every name of a shared texture still gets documented */
+	for (tex = obj->tex; tex; tex = tex->next)
+	{
+		struct objex_texture *src = tex->aliasOf;
+		
+		if (!src
+			|| !tex->isUsed
+			|| src->objex != obj
+			|| src->commonRef
+		)
+			continue;
+		
+		document_assign(
+			pathTail(tex->name),
+			NULL,
+			((struct texUdata*)src->udata)->fileOfs + getBase(obj),
+			T_TEX
+		);
+	}
+	
 	return success;
 }
 
@@ -1021,28 +2630,284 @@ void *texture_writePalette(VFILE *bin, struct objex_palette *pal)
 void *texture_writePalettes(VFILE *bin, struct objex *obj)
 {
 	struct objex_palette *pal;
+	extern int printPalettes;
+	
+	/* palettes stored within others keep those in use */
+	for (pal = obj->pal; pal; pal = pal->next)
+		if (pal->pooled && pal->isUsed)
+			pal->pooled->isUsed = 1;
 	
 	for (pal = obj->pal; pal; pal = pal->next)
 	{
+		if (pal->pooled)
+			continue;
+		
 		if (!texture_writePalette(bin, pal))
 			return errmsg(0);
 	}
 	
+	/* now that their storage has been written, locate pooled palettes */
+	for (pal = obj->pal; pal; pal = pal->next)
+	{
+		if (!pal->pooled || !pal->isUsed)
+			continue;
+		
+		pal->fileOfs = pal->pooled->fileOfs + pal->pooledOfs;
+		if (pal->pointer == 0)
+			pal->pointer = pal->fileOfs + getBase(pal->objex);
+		if (printPalettes)
+			document_assign(
+				int2str(pal->index),
+				NULL,
+				pal->fileOfs + getBase(pal->objex),
+				T_PAL
+			);
+	}
+	
+	return success;
+}
+
+/* a palette is in use if any texture using it is */
+static bool palette_isUsed(struct objex *obj, struct objex_palette *pal)
+{
+	for (struct objex_texture *tex = obj->tex; tex; tex = tex->next)
+		if (tex->palette == pal && tex->isUsed)
+			return true;
+	
+	return false;
+}
+
+/* remap the color indices of every texture using `pal` to index
+ * into `dst` instead, starting at color `start`; returns 0 if not
+ * every color can be found within reach of those textures
+ */
+static bool palette_remap(
+	struct objex *obj
+	, struct objex_palette *pal
+	, struct objex_palette *dst
+	, int start
+	, bool test
+)
+{
+	const uint16_t *src = pal->colors;
+	const uint16_t *pool = dst->colors;
+	unsigned char lut[256];
+	
+	for (struct objex_texture *tex = obj->tex; tex; tex = tex->next)
+	{
+		struct texUdata *udata = tex->udata;
+		unsigned char *pix;
+		int reach;
+		int i;
+		
+		if (tex->palette != pal)
+			continue;
+		
+		/* textures referenced by pointer can't be remapped */
+		if (tex->pointer || !udata || !unspillPix(tex) || !(pix = tex->pix))
+			return false;
+		
+		/* 4-bit textures see only 16 colors */
+		reach = (udata->gbiBpp == N64TEXCONV_4) ? 16 : 256;
+		if (reach > dst->colorsNum - start)
+			reach = dst->colorsNum - start;
+		
+		for (i = 0; i < pal->colorsNum; ++i)
+		{
+			int k;
+			
+			for (k = 0; k < reach; ++k)
+				if (pool[start + k] == src[i])
+					break;
+			if (k == reach)
+				return false;
+			lut[i] = k;
+		}
+		
+		if (test)
+			continue;
+		
+		if (udata->gbiBpp == N64TEXCONV_4)
+			for (i = 0; i < udata->fileSz; ++i)
+				pix[i] = (lut[pix[i] >> 4] << 4) | lut[pix[i] & 15];
+		else
+			for (i = 0; i < udata->fileSz; ++i)
+				pix[i] = lut[pix[i]];
+	}
+	
+	return true;
+}
+
+/* palettes identical to, or a prefix of, another palette are stored
+ * within that palette; with mergePalettes, so are those whose colors
+ * are all contained in another (indices of textures get remapped)
+ * NOTE this should be called before textures are written
+ */
+void *texture_poolPalettes(struct objex *obj)
+{
+	extern int mergePalettes;
+	struct pool {
+		struct objex_palette *pal;
+		unsigned hash;
+		bool isUsed;
+		bool isTarget;
+	} *pool;
+	struct objex_palette *pal;
+	int num = 0;
+	int i;
+	int k;
+	
+	for (pal = obj->pal; pal; pal = pal->next)
+		++num;
+	if (!num)
+		return success;
+	if (!(pool = calloc(num, sizeof(*pool))))
+		return errmsg(ERR_NOMEM);
+	
+	/* hash final colors (rgba5551) */
+	for (i = 0, pal = obj->pal; pal; pal = pal->next, ++i)
+	{
+		unsigned char *c = pal->colors;
+		unsigned hash = 2166136261u;
+		
+		for (k = 0; k < pal->colorsSize; ++k)
+			hash = (hash ^ c[k]) * 16777619u;
+		
+		pal->pooled = 0;
+		pal->pooledOfs = 0;
+		pool[i].pal = pal;
+		pool[i].hash = hash;
+		pool[i].isUsed = !pal->pointer && palette_isUsed(obj, pal);
+	}
+	
+	/* exact duplicates share the first of them */
+	for (i = 0; i < num; ++i)
+	{
+		struct pool *a = &pool[i];
+		
+		if (!a->isUsed)
+			continue;
+		
+		for (k = 0; k < i; ++k)
+		{
+			struct pool *b = &pool[k];
+			
+			if (!b->isUsed
+				|| b->pal->pooled
+				|| b->hash != a->hash
+				|| b->pal->colorsSize != a->pal->colorsSize
+				|| memcmp(b->pal->colors, a->pal->colors, a->pal->colorsSize)
+			)
+				continue;
+			
+			a->pal->pooled = b->pal;
+			b->isTarget = true;
+			break;
+		}
+	}
+	
+	/* prefixes share the longer palette, no remapping needed */
+	for (i = 0; i < num; ++i)
+	{
+		struct pool *a = &pool[i];
+		
+		if (!a->isUsed || a->pal->pooled)
+			continue;
+		
+		for (k = 0; k < num; ++k)
+		{
+			struct pool *b = &pool[k];
+			
+			if (!b->isUsed
+				|| b->pal->pooled
+				|| b->pal->colorsSize <= a->pal->colorsSize
+				|| memcmp(b->pal->colors, a->pal->colors, a->pal->colorsSize)
+			)
+				continue;
+			
+			a->pal->pooled = b->pal;
+			b->isTarget = true;
+			break;
+		}
+	}
+	
+	/* subsets share a palette containing all their colors */
+	for (i = 0; mergePalettes && i < num; ++i)
+	{
+		struct pool *a = &pool[i];
+		
+		if (!a->isUsed || a->isTarget || a->pal->pooled)
+			continue;
+		
+		for (k = 0; k < num; ++k)
+		{
+			struct pool *b = &pool[k];
+			int start;
+			
+			if (k == i
+				|| !b->isUsed
+				|| b->pal->pooled
+				|| b->pal->colorsNum <= a->pal->colorsNum
+			)
+				continue;
+			
+			/* palettes are 8-byte aligned, so 4-color steps */
+			for (start = 0; start < b->pal->colorsNum; start += 4)
+				if (palette_remap(obj, a->pal, b->pal, start, true))
+					break;
+			if (start >= b->pal->colorsNum)
+				continue;
+			
+			palette_remap(obj, a->pal, b->pal, start, false);
+			a->pal->pooled = b->pal;
+			a->pal->pooledOfs = start * 2;
+			b->isTarget = true;
+			break;
+		}
+	}
+	
+	/* point every pooled palette at storage that gets written */
+	for (i = 0; i < num; ++i)
+	{
+		pal = pool[i].pal;
+		
+		while (pal->pooled && pal->pooled->pooled)
+		{
+			pal->pooledOfs += pal->pooled->pooledOfs;
+			pal->pooled = pal->pooled->pooled;
+		}
+	}
+	
+	free(pool);
 	return success;
 }
 
 int texture_equals(const struct objex_texture *a, const struct objex_texture *b)
 {
 	//fprintf(stderr, "compare '%s' v '%s'\n", a->name, b->name);
+	void *tmpA = 0;
+	void *tmpB = 0;
+	const void *pixA;
+	const void *pixB;
+	int rv;
 	
-	return a->crc32 == b->crc32
+	if (!(a->crc32 == b->crc32
 		&& a->fmt == b->fmt
 		&& a->bpp == b->bpp
 		&& a->sz == b->sz
 		&& a->w == b->w
 		&& a->h == b->h
-		&& !memcmp(a->pix, b->pix, a->sz) // XXX overkill; comment this line if slow
-	;
+	))
+		return 0;
+	
+	/* XXX overkill; comment this out if slow */
+	pixA = texData(a, &tmpA);
+	pixB = texData(b, &tmpB);
+	rv = pixA && pixB && !memcmp(pixA, pixB, a->sz);
+	free(tmpA);
+	free(tmpB);
+	
+	return rv;
 }
 
 struct objex_texture *texture_copy(struct objex_texture *src)
@@ -1063,6 +2928,10 @@ struct objex_texture *texture_findMatch(struct objex_texture *needle, struct obj
 	if (needle->commonRef)
 		return 0;
 	
+	/* aliases follow the texture they are identical to */
+	if (needle->aliasOf)
+		return 0;
+	
 	/* palettes not planned to be supported for a while */
 	if (needle->palette != 0)
 	{
@@ -1074,7 +2943,7 @@ struct objex_texture *texture_findMatch(struct objex_texture *needle, struct obj
 	{
 		assert(tex != needle);
 		
-		if (texture_equals(needle, tex))
+		if (!tex->aliasOf && texture_equals(needle, tex))
 			return tex;
 		
 		next = tex->next;
@@ -1111,6 +2980,10 @@ void *texture_procMaterials(struct objex *obj)
 			*tex0 = mat->tex0
 			, *tex1 = mat->tex1
 		;
+		if (tex0 && tex0->aliasOf)
+			tex0 = tex0->aliasOf;
+		if (tex1 && tex1->aliasOf)
+			tex1 = tex1->aliasOf;
 		if (tex0 && tex0->commonRef)
 			tex0 = tex0->commonRef;
 		if (tex1 && tex1->commonRef)
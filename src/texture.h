@@ -1,5 +1,6 @@
 #ifndef TEXTURE_H_INCLUDED
 #define TEXTURE_H_INCLUDED
+#include <stdint.h>
 #include "objex.h"
 #include "vfile.h"
 
@@ -8,6 +9,8 @@ struct mtlUdata
 	objex_udata_free  free;
 	int wrotePalette;
 	int wroteTexture;
+	unsigned int atlasSkip; /* bytes loading the atlas at the start */
+	int blend; /* mtl_isBlended: 0 = not yet known, 1 = no, 2 = yes */
 };
 
 struct texUdata
@@ -26,20 +29,34 @@ struct texUdata
 	struct
 	{
 		float w;  /* these get multiplied into UV coordinates  */
-		float h;  /* (a last-minute addition for u/v mirroring */
+		float h;  /* (for u/v mirroring and repeating tiles)   */
 	} uvMult;
 	int isSmirror;
 	int isTmirror;
+	struct objex_texture *atlas;     /* first texture of its atlas */
+	struct objex_texture *atlasNext; /* next texture in same atlas */
+	size_t atlasOfs;  /* offset within the atlas, once written */
+	size_t atlasFileOfs; /* (first texture) where the atlas starts */
+	int atlasH;       /* (first texture) total height, 0 = no atlas */
+	int64_t spillOfs; /* where converted data went in the spill file */
+	int isSpilled;    /* converted data is in the spill file, not pix */
+	int pixChannels;  /* bytes per pixel until converted: 4 = rgba8888,
+	                   * 1 or 2 = gray (+ alpha) bound for i or ia */
 };
 
 extern void *texture_loadAll(struct objex *obj);
+extern void *texture_autoFormats(struct objex *obj);
+extern void *texture_clusterPalettes(struct objex *obj);
 extern void *texture_procSharedPalettes(struct objex *obj);
 extern void *texture_procTextures(struct objex *obj);
+extern void *texture_buildAtlases(struct objex *obj);
 extern const char *texture_errmsg(void);
 extern void *texture_writeTextures(VFILE *bin, struct objex *obj);
 extern void *texture_writePalettes(VFILE *bin, struct objex *obj);
+extern void *texture_poolPalettes(struct objex *obj);
 extern void *texture_writeTexture(VFILE *bin, struct objex_texture *tex);
 struct objex_texture *texture_findMatch(struct objex_texture *needle, struct objex_texture *haystack);
 struct objex_texture *texture_copy(struct objex_texture *src);
+void texture_closeSpill(void);
 #endif /* TEXTURE_H_INCLUDED */
 
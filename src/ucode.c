@@ -0,0 +1,115 @@
+/* <z64.me> ucode.c: microcode backends for display list writing */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ucode.h"
+#include <gfxasm.h>
+
+/* f3dex2 and f3dex3 share these encodings */
+static Gfx f3dex2_vertex(uint32_t addr, int num, int v0)
+{
+	return gsSPVertex(addr, num, v0);
+}
+
+static Gfx f3dex2_tri1(int v0, int v1, int v2)
+{
+	return gsSP1Triangle(v0, v1, v2, 0);
+}
+
+static Gfx f3dex2_tri2(int v00, int v01, int v02, int v10, int v11, int v12)
+{
+	return gsSP2Triangles(v00, v01, v02, 0, v10, v11, v12, 0);
+}
+
+static Gfx f3dex2_matrix(uint32_t addr, bool load)
+{
+	return gsSPMatrix(
+		addr
+		, G_MTX_NOPUSH | (load ? G_MTX_LOAD : G_MTX_MUL) | G_MTX_MODELVIEW
+	);
+}
+
+/* f3dex3 G_TRISTRIP: seven indices make up to five triangles
+ * (v1 v2 v3) (v3 v2 v4) (v3 v4 v5) (v5 v4 v6) (v5 v6 v7); shorter
+ * strips repeat their last index, making the rest degenerate
+ */
+#define F3DEX3_G_TRISTRIP 0x08
+static Gfx f3dex3_strip(const int *v, int num)
+{
+	uint8_t idx[7];
+	
+	assert(num >= 3 && num <= 7);
+	
+	for (int i = 0; i < 7; ++i)
+		idx[i] = v[i < num ? i : num - 1] * 2;
+	
+	return gO_(
+		F3DEX3_G_TRISTRIP
+		, gF_(idx[0], 8, 16) | gF_(idx[1], 8, 8) | gF_(idx[2], 8, 0)
+		, gF_(idx[3], 8, 24) | gF_(idx[4], 8, 16) | gF_(idx[5], 8, 8)
+			| gF_(idx[6], 8, 0)
+	);
+}
+
+static const struct ucode ucodeList[] = {
+	{
+		.name = "f3dex2"
+		, .gbi = f3dex2_exec
+		, .vbufMax = 32
+		, .dlStackMax = 18
+		, .vertex = f3dex2_vertex
+		, .tri1 = f3dex2_tri1
+		, .tri2 = f3dex2_tri2
+		, .matrix = f3dex2_matrix
+	}
+	/* oot and mm's f3dex2 build */
+	, {
+		.name = "f3dzex"
+		, .gbi = f3dex2_exec
+		, .vbufMax = 32
+		, .dlStackMax = 18
+		, .vertex = f3dex2_vertex
+		, .tri1 = f3dex2_tri1
+		, .tri2 = f3dex2_tri2
+		, .matrix = f3dex2_matrix
+	}
+	/* materials still assemble as f3dex2, which f3dex3 is
+	 * compatible with for everything a material may contain
+	 */
+	, {
+		.name = "f3dex3"
+		, .gbi = f3dex2_exec
+		, .vbufMax = 56
+		, .stripMax = 5
+		, .dlStackMax = 18
+		, .vertex = f3dex2_vertex
+		, .tri1 = f3dex2_tri1
+		, .tri2 = f3dex2_tri2
+		, .strip = f3dex3_strip
+		, .matrix = f3dex2_matrix
+	}
+};
+
+const struct ucode *gUcode = ucodeList;
+
+/* returns error string on failure, 0 on success */
+const char *ucode_select(const char *name)
+{
+	if (!name)
+		return "--ucode incomplete";
+	
+	for (int i = 0; i < (int)(sizeof(ucodeList) / sizeof(*ucodeList)); ++i)
+	{
+		if (!strcmp(ucodeList[i].name, name))
+		{
+			gUcode = ucodeList + i;
+			assert(gUcode->vbufMax <= UCODE_VBUF_CAP);
+			return 0;
+		}
+	}
+	
+	return "unknown --ucode; expected f3dex2, f3dzex, or f3dex3";
+}
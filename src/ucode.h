@@ -0,0 +1,40 @@
+/* <z64.me> ucode.h: microcode backends for display list writing */
+
+#ifndef UCODE_H_INCLUDED
+#define UCODE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef F3DEX_GBI_2
+#define F3DEX_GBI_2 1
+#endif
+#include "gbi.h"
+
+/* largest vertex buffer of any backend */
+#define UCODE_VBUF_CAP 64
+
+/* the commands that differ between microcodes; everything else
+ * written (branches, geometry mode, rdp commands) is shared by the
+ * f3dex2 family, which all of these belong to
+ */
+struct ucode
+{
+	const char *name;
+	uint32_t *(*gbi)(const char *str); /* gfxasm target for material gbi */
+	int vbufMax;  /* vertices the vertex buffer holds */
+	int stripMax; /* triangles one strip command draws, 0 = no strips */
+	int dlStackMax; /* display lists that can be nested */
+	Gfx (*vertex)(uint32_t addr, int num, int v0);
+	Gfx (*tri1)(int v0, int v1, int v2);
+	Gfx (*tri2)(int v00, int v01, int v02, int v10, int v11, int v12);
+	Gfx (*strip)(const int *v, int num); /* num - 2 triangles */
+	Gfx (*matrix)(uint32_t addr, bool load); /* modelview, no push */
+};
+
+/* microcode display lists are written for */
+extern const struct ucode *gUcode;
+
+extern const char *ucode_select(const char *name);
+
+#endif /* UCODE_H_INCLUDED */
@@ -266,6 +266,16 @@ int vfseek(VFILE *stream, long offset, int whence)
 	return 0; /* success */
 }
 
+/* discards everything past the current offset */
+VFILE_VISIBILITY
+void vftruncate(VFILE *stream)
+{
+	if (!stream)
+		return;
+	
+	stream->end = stream->ofs;
+}
+
 /* vfile.h versions */
 static inline void vfput8(VFILE *bin, unsigned char b)
 {
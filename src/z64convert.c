@@ -14,6 +14,7 @@
 #include "collider.h"
 #include "collision.h"
 #include "doc.h"
+#include "ucode.h"
 
 void fprintf_safe(FILE *dst, const char *fmt, ...)
 {
@@ -74,6 +75,22 @@ struct model
 
 #include <wow.h>
 int printPalettes = 0;
+int ditherTextures = 0;
+int mergePalettes = 0;
+float autoPalettes = -1;
+float autoFormat = -1;
+int atlasTextures = 0;
+int maxMemory = 0; /* MiB, 0 = unlimited */
+int reorderTriangles = 0;
+int orderMaterials = 0;
+int residentVertices = 0;
+int poolVertices = 0;
+int poolDlists = 0;
+int peephole = 0;
+int deltaMaterials = 0;
+int batchLimbs = 0;
+int autoStandalone = 0;
+int flattenBranches = 0;
 enum binaryHeaderFlags binaryHeader = 0;
 
 /* DONE --only "bunnyhood,riggedmesh,etc" argument for saying to only
@@ -278,6 +295,9 @@ static void model_free(struct model *model)
 	if (model->obj)
 		objex_free(model->obj, free);
 	
+	/* spilled texture data went with the textures */
+	texture_closeSpill();
+	
 	free(model);
 	
 L_cleanup:
@@ -385,11 +405,16 @@ static const char *model_commit(struct model *model)
 	}
 	
 	/* write textures and palettes to out file */
-	if (!texture_writeTextures(zobj, obj)
+	if (!texture_poolPalettes(obj)
+	   || !texture_writeTextures(zobj, obj)
 	   || !texture_writePalettes(zobj, obj)
 	)
 		fail(texture_errmsg());
 	
+	/* call only the materials it saves space to call */
+	if (autoStandalone && !zobj_chooseStandalone(obj, isMesh))
+		fail(zobj_errmsg());
+	
 	/* write any standalone materials */
 	for (struct objex_material *mtl = obj->mtl; mtl; mtl = mtl->next)
 	{
@@ -578,12 +603,25 @@ static const char *model_commit(struct model *model)
 	if (!zobj_doRelocs(zobj, obj))
 		fail(zobj_errmsg());
 	
+	/* every display list is where it will stay, so shorten branches */
+	if (flattenBranches && !zobj_flattenBranches(zobj, obj))
+		fail(zobj_errmsg());
+	
+	/* what standalone materials, material order, limb batching, shared
+	 * vertices and display lists, delta materials, the peephole and
+	 * branch flattening saved
+	 */
+	zobj_printDlistStats(docs, obj);
+	
 	/* now that we've reloc'd, print proxyArrayLists */
 	for (int i = 0; i < proxyArrayNum; ++i)
 	{
 		struct zobjProxyArray *p = proxyArrayList[i];
-		/* unnesting no longer necessary? leave it this way for safety */
-		zobjProxyArray_unnest(zobj, p, baseOfs);
+		/* unnesting no longer necessary? leave it this way for safety;
+		 * --flatten-branches has already done it for every list
+		 */
+		if (!flattenBranches)
+			zobjProxyArray_unnest(zobj, p, baseOfs);
 		
 		if (!zobjProxyArray_print(docs, zobj, p, baseOfs))
 			fail(zobj_errmsg());
@@ -743,10 +781,13 @@ static struct model *model_load(
 	if (
 //		!fprintf(stderr, "loading textures...\n") ||
 		!texture_loadAll(obj)
+	   || !texture_autoFormats(obj)
+	   || !texture_clusterPalettes(obj)
 //		|| !fprintf(stderr, "processing shared palettes...\n")
 	   || !texture_procSharedPalettes(obj)
 //		|| !fprintf(stderr, "processing textures...\n")
 	   || !texture_procTextures(obj)
+	   || !texture_buildAtlases(obj)
 	)
 		fail(texture_errmsg());
 	
@@ -1152,6 +1193,11 @@ gsSPClearGeometryMode(G_TEXTURE_GEN | G_TEXTURE_GEN_LINEAR),\n\
 		}
 	}
 	
+	/* textures identical to another keep that one in use */
+	for (struct objex_texture *m = obj->tex; m; m = m->next)
+		if (m->aliasOf && m->isUsed)
+			m->aliasOf->isUsed = 1;
+	
 	/* if applicable, internally divide the objex into more objex's */
 	if (!objex_divide(obj, docs))
 		fail(objex_errmsg());
@@ -1219,6 +1265,63 @@ const char *z64convert(
 		}
 		else if (streq(argv[i], "--print-palettes"))
 			printPalettes = 1;
+		else if (streq(argv[i], "--dither"))
+			ditherTextures = 1;
+		else if (streq(argv[i], "--merge-palettes"))
+			mergePalettes = 1;
+		else if (streq(argv[i], "--atlas"))
+			atlasTextures = 1;
+		else if (streq(argv[i], "--reorder-triangles"))
+			reorderTriangles = 1;
+		else if (streq(argv[i], "--order-materials"))
+			orderMaterials = 1;
+		else if (streq(argv[i], "--resident-vertices"))
+			residentVertices = 1;
+		else if (streq(argv[i], "--pool-vertices"))
+			poolVertices = 1;
+		else if (streq(argv[i], "--pool-dlists"))
+			poolDlists = 1;
+		else if (streq(argv[i], "--peephole"))
+			peephole = 1;
+		else if (streq(argv[i], "--delta-materials"))
+			deltaMaterials = 1;
+		else if (streq(argv[i], "--batch-limbs"))
+			batchLimbs = 1;
+		else if (streq(argv[i], "--auto-standalone"))
+			autoStandalone = 1;
+		else if (streq(argv[i], "--flatten-branches"))
+			flattenBranches = 1;
+		else if (streq(argv[i], "--auto-palettes"))
+		{
+			if (!argv[i+1]
+			   || sscanf(argv[++i], "%f", &autoPalettes) != 1
+			   || autoPalettes < 0
+			)
+				return "invalid arguments";
+		}
+		else if (streq(argv[i], "--max-memory"))
+		{
+			if (!argv[i+1]
+			   || sscanf(argv[++i], "%d", &maxMemory) != 1
+			   || maxMemory <= 0
+			)
+				return "invalid arguments";
+		}
+		else if (streq(argv[i], "--auto-format"))
+		{
+			if (!argv[i+1]
+			   || sscanf(argv[++i], "%f", &autoFormat) != 1
+			   || autoFormat < 0
+			)
+				return "invalid arguments";
+		}
+		else if (streq(argv[i], "--ucode"))
+		{
+			const char *rv = ucode_select(argv[++i]);
+			
+			if (rv)
+				return rv;
+		}
 		else if (streq(argv[i], "--binary-header"))
 		{
 			const char *rv = binaryHeaderFlagsFromString(argv[++i], &binaryHeader);
@@ -18,13 +18,15 @@
 
 #define F3DEX_GBI_2 1
 #include "gbi.h"
+#include "ucode.h"
 
 /* external dependencies */
 #include "n64texconv.h"
 
 struct objex_g *gCurrentGroup = 0;
 
-#define VBUF_MAX 32
+/* atlas known to be in TMEM at the current point of a display list */
+static struct objex_texture *gLoadedAtlas = 0;
 
 static FILE *getDocs(struct objex *obj)
 {
@@ -33,6 +35,14 @@ static FILE *getDocs(struct objex *obj)
 	return ((struct objexUdata *)obj->udata)->docs;
 }
 
+/* writes a modelview matrix command that loads or multiplies */
+static void putMatrix(VFILE *bin, uint32_t addr, bool load)
+{
+	Gfx gfx = gUcode->matrix(addr, load);
+	
+	vfput64s(bin, gfx.hi, gfx.lo);
+}
+
 static unsigned getBase(struct objex *obj)
 {
 	if (!obj || !obj->udata)
@@ -52,6 +62,22 @@ void objexUdataFree(void *udata_)
 		free(r);
 	}
 	
+	if (udata->vtxPool)
+	{
+		struct vtxPool *pool = udata->vtxPool;
+		free(pool->rec);
+		free(pool->ofs);
+		free(pool->next);
+		free(pool->head);
+		free(pool);
+	}
+	
+	if (udata->dlPool)
+	{
+		free(udata->dlPool->block);
+		free(udata->dlPool);
+	}
+	
 	free(udata);
 };
 struct zobjProxyArray *zobjProxyArray_new(const char *name, int num)
@@ -386,6 +412,27 @@ struct compvert
 )
 KSORT_INIT(compvert, struct compvert, compvert_lt)
 
+/* same, but vertices within a subgroup in order of content, so the
+ * same vertices get written the same way wherever they are loaded
+ * together (--pool-vertices)
+ */
+#define compvert_pool_lt(a, b) \
+( \
+	(compvert_lt(a, b) || compvert_lt(b, a)) \
+	? compvert_lt(a, b) \
+	: compvert_content_lt(&(a), &(b)) \
+)
+static bool compvert_content_lt(const struct compvert *a, const struct compvert *b)
+{
+	if (a->x != b->x) return a->x < b->x;
+	if (a->y != b->y) return a->y < b->y;
+	if (a->z != b->z) return a->z < b->z;
+	if (a->s != b->s) return a->s < b->s;
+	if (a->t != b->t) return a->t < b->t;
+	return a->rgba < b->rgba;
+}
+KSORT_INIT(compvertPool, struct compvert, compvert_pool_lt)
+
 /* sort compvert by subgroup */
 static int compvert_sort_subgroup(const void *a, const void *b)
 {
@@ -423,6 +470,7 @@ static void groupUdata_free(void *udata_)
 		free(r);
 	}
 	
+	free(udata->vtxLoad);
 	free(udata);
 }
 
@@ -435,6 +483,23 @@ static struct groupUdata *groupUdata_new(void)
 	return gUdata;
 }
 
+/* the bone whose matrix transforms a vertex, if any */
+static struct objex_bone *v_matrixBone(const struct objex_v *v)
+{
+	struct objex_bone *b;
+	
+	if (!v->weight || !(b = v->weight->bone) || !b->udata)
+		return 0;
+	
+	/* is root bone and root has parent, so override it */
+	if (b == b->skeleton->bone/*root*/
+		&& b->skeleton->parent/*has parent*/
+	)
+		return b->skeleton->parent;
+	
+	return b;
+}
+
 static struct compvert
 compbuf_new(
 	struct objex_g *g
@@ -549,19 +614,14 @@ compbuf_new(
 	}
 	
 	/* vertex describes bone */
-	if (v->weight && v->weight->bone && v->weight->bone->udata)
+	if ((result.bone = v_matrixBone(v)))
 	{
 		struct boneUdata *bUdat;
-		result.bone = v->weight->bone;
 		
-		/* is root bone and root has parent, so override it */
-		if (result.bone == result.bone->skeleton->bone/*root*/
-			&& result.bone->skeleton->parent/*has parent*/
-		) {
-			//debugf("%s override\n", result.bone->name);
-			result.bone = result.bone->skeleton->parent;
-		}
-		else if (result.bone->skeleton->isPbody)
+		/* an overridden root is transformed as the parent skeleton */
+		if (result.bone == v->weight->bone
+			&& result.bone->skeleton->isPbody
+		)
 			result.bf.bf.usePbody = 1;
 		bUdat = result.bone->udata;
 		//bUdat = v->weight->bone->udata;
@@ -765,6 +825,66 @@ static void strins(char **dst, char *src)
 	memcpy(*dst, src, strlen(src));
 }
 
+/* returns the first texture of the atlas a material's texture gets
+ * loaded from, or 0 if it's loaded on its own
+ */
+static struct objex_texture *mtl_atlas(struct objex_material *mtl)
+{
+	struct objex_texture *tex = mtl->tex0;
+	struct texUdata *udata;
+	
+	/* only single-textured materials using _loadtexels */
+	if (!tex || mtl->tex1 || !mtl->gbi || !strstr(mtl->gbi, "_loadtexels"))
+		return 0;
+	if (tex->aliasOf)
+		tex = tex->aliasOf;
+	if (tex->commonRef)
+		tex = tex->commonRef;
+	
+	if (!(udata = tex->udata) || !udata->atlas || !tex->isUsed)
+		return 0;
+	if (!((struct texUdata*)udata->atlas->udata)->atlasH)
+		return 0;
+	
+	return udata->atlas;
+}
+
+/* gbi loading an atlas, and its palette if it has one */
+static void atlas_load(char *dst, struct objex_texture *atlas)
+{
+	struct texUdata *udata = atlas->udata;
+	unsigned int base = getBase(atlas->objex);
+	int is4bit = udata->gbiBpp == N64TEXCONV_4;
+	
+	*dst = '\0';
+	if (atlas->palette)
+		dst += sprintf(
+			dst
+			, "%s0x%08X),\n"
+			, is4bit ? "gsDPLoadTLUT_pal16(15, " : "gsDPLoadTLUT_pal256("
+			, (unsigned)atlas->palette->fileOfs + base
+		);
+	if (is4bit)
+		sprintf(
+			dst
+			, "gsDPLoadTextureBlock_4b(0x%08X, %s, %d, %d, 15, G_TX_NOMIRROR | G_TX_CLAMP, G_TX_NOMIRROR | G_TX_CLAMP, G_TX_NOMASK, G_TX_NOMASK, G_TX_NOLOD, G_TX_NOLOD),\n"
+			, (unsigned)udata->atlasFileOfs + base
+			, udata->gbiFmtStr
+			, atlas->w
+			, udata->atlasH
+		);
+	else
+		sprintf(
+			dst
+			, "gsDPLoadTextureBlock(0x%08X, %s, %s, %d, %d, 0, G_TX_NOMIRROR | G_TX_CLAMP, G_TX_NOMIRROR | G_TX_CLAMP, G_TX_NOMASK, G_TX_NOMASK, G_TX_NOLOD, G_TX_NOLOD),\n"
+			, (unsigned)udata->atlasFileOfs + base
+			, udata->gbiFmtStr
+			, udata->gbiBppStr
+			, atlas->w
+			, udata->atlasH
+		);
+}
+
 static void *expand_loadtexel(
 	char which
 	, struct objex_material *mtl
@@ -779,6 +899,7 @@ static void *expand_loadtexel(
 	struct mtlUdata *mtlUdata = mtl->udata;
 	struct objex_texture *tex = (which == '0') ? mtl->tex0 : mtl->tex1;
 	struct objex *objex = mtl->objex;
+	if (tex && tex->aliasOf) { tex = tex->aliasOf; objex = tex->objex; }
 	if (tex && tex->commonRef) { tex = tex->commonRef; objex = tex->objex; }
 	struct objexUdata *udata = objex->udata;
 	unsigned int baseOfs = udata->baseOfs;
@@ -792,6 +913,51 @@ static void *expand_loadtexel(
 	
 	is4bit = ((struct texUdata*)tex->udata)->gbiBpp == N64TEXCONV_4;
 	
+	/* the atlas (and palette) get loaded at the start of the material,
+	 * so only the render tile needs to point into it
+	 */
+	if (mtl_atlas(mtl))
+	{
+		struct texUdata *udata = tex->udata;
+		
+		if (palette_only)
+		{
+			if (tex->palette)
+				strins(at, "gsDPSetTextureLUT(G_TT_RGBA16),\n");
+			else
+				strins(at, "gsDPSetTextureLUT(G_TT_NONE),\n");
+			mtlUdata->wrotePalette = 1;
+		}
+		else
+		{
+			sprintf(
+				tbuf
+				, "gsDPTileSync(),\n"
+				"gsDPSetTile(_texel%cformat, _texel%cbitdepth, %d, %d, G_TX_RENDERTILE, %d, %s, %s, %s, %s, %s, %s),\n"
+				, which, which
+				, (int)((tex->w << udata->gbiBpp) / 16) /* 64-bit words per line */
+				, (int)(udata->atlasOfs / 8)
+				, is4bit ? 15 : 0
+				, mtl->gbivar[OBJEX_GBIVAR_CMT0    + o]
+				, mtl->gbivar[OBJEX_GBIVAR_MASKT0  + o]
+				, mtl->gbivar[OBJEX_GBIVAR_SHIFTT0 + o]
+				, mtl->gbivar[OBJEX_GBIVAR_CMS0    + o]
+				, mtl->gbivar[OBJEX_GBIVAR_MASKS0  + o]
+				, mtl->gbivar[OBJEX_GBIVAR_SHIFTS0 + o]
+			);
+			/* otherwise the tile stays the size of the whole atlas */
+			if (!strstr(mtl->gbi, "gsDPSetTileSize"))
+				sprintf(
+					tbuf + strlen(tbuf)
+					, "gsDPSetTileSize(G_TX_RENDERTILE, 0, 0, qu102(_texel%cwidth-1), qu102(_texel%cheight-1)),\n"
+					, which, which
+				);
+			strins(at, tbuf);
+			mtlUdata->wroteTexture = 1;
+		}
+		return success;
+	}
+	
 //	at += strlen(at);
 	
 	/* palette prefix (if applicable) */
@@ -969,18 +1135,28 @@ static void *mtl_gbi_vars(struct objex_material *mtl, char *gbi)
 	unsigned int t0palette = 0;
 	unsigned int t1palette = 0;
 	if (tex0) {
+		if (tex0->aliasOf)
+			tex0 = tex0->aliasOf;
 		if (tex0->commonRef)
 			tex0 = tex0->commonRef;
 		t0 = tex0->udata;
-		t0palette = (tex0->palette) ? tex0->palette->fileOfs : 0;
-		t0palette += baseOfs;
+		/* palettes live where their texture does (e.g. common) */
+		t0palette = (tex0->palette)
+			? tex0->palette->fileOfs + getBase(tex0->palette->objex)
+			: baseOfs
+		;
 	}
 	if (tex1) {
+		if (tex1->aliasOf)
+			tex1 = tex1->aliasOf;
 		if (tex1->commonRef)
 			tex1 = tex1->commonRef;
 		t1 = tex1->udata;
-		t1palette = (tex1->palette) ? tex1->palette->fileOfs : 0;
-		t1palette += baseOfs;
+		/* palettes live where their texture does (e.g. common) */
+		t1palette = (tex1->palette)
+			? tex1->palette->fileOfs + getBase(tex1->palette->objex)
+			: baseOfs
+		;
 	}
 	
 	while (1)
@@ -1041,12 +1217,8 @@ static void *mtl_gbi_vars(struct objex_material *mtl, char *gbi)
 		int h = tex0->h / t0->virtDiv;
 		int maskS = num2(w);
 		int maskT = num2(h);
-		int wTile = w;
-		int hTile = h;
-		if (t0->isSmirror)
-			wTile *= 2;
-		if (t0->isTmirror)
-			hTile *= 2;
+		int wTile = w * t0->uvMult.w; /* mirrored or repeated */
+		int hTile = h * t0->uvMult.h;
 		// if t0 has segment override, use that
 		if (tex0->pointer)
 			addr = tex0->pointer;
@@ -1076,12 +1248,8 @@ static void *mtl_gbi_vars(struct objex_material *mtl, char *gbi)
 		int h = tex1->h / t1->virtDiv;
 		int maskS = num2(w);
 		int maskT = num2(h);
-		int wTile = w;
-		int hTile = h;
-		if (t1->isSmirror)
-			wTile *= 2;
-		if (t1->isTmirror)
-			hTile *= 2;
+		int wTile = w * t1->uvMult.w; /* mirrored or repeated */
+		int hTile = h * t1->uvMult.h;
 		// if t1 has segment override, use that
 		if (tex1->pointer)
 			addr = tex1->pointer;
@@ -1121,126 +1289,762 @@ static void *group_reloc(struct objex_g *g, size_t ofs)
 	return success;
 }
 
-void *zobj_writeUsemtl(VFILE *bin, struct objex_material *mtl)
+/* --peephole, --delta-materials: the state a display list has set so
+ * far, where known; commands that would set it to what it already is
+ * change nothing
+ */
+#define DLREG_NUM 24
+#define DLLOAD_NUM 8
+#define DLTMEM_SIZE 4096
+struct dlState
 {
-	if (!mtl)
-		return success;
+	uint32_t geoKnown;   /* geometry mode bits known */
+	uint32_t geo;
+	uint32_t omKnown[2]; /* othermode hi and lo bits known */
+	uint32_t om[2];
+	uint32_t reg[DLREG_NUM][2]; /* last command replacing a register */
+	uint32_t regKnown;
+	uint32_t mtx;        /* modelview matrix last loaded */
+	bool mtxKnown;
+	bool drawn;          /* drawn since the last pipe sync */
+	bool tileDrawn;      /* drawn since the last tile sync */
+	bool loaded;         /* loaded since the last load sync */
+	struct {
+		uint32_t timg[2];    /* texture image it loaded from */
+		uint32_t tile[2];    /* load tile's descriptor */
+		uint32_t load[2];    /* the load command */
+		unsigned start;      /* bytes of tmem it holds */
+		unsigned end;
+	} tmem[DLLOAD_NUM];  /* loads still intact in tmem, oldest first */
+	int tmemNum;
+};
+
+static void dlState_forget(struct dlState *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->drawn = true;
+	st->tileDrawn = true;
+	st->loaded = true;
+}
+
+/* commands that replace all of one register, or -1 */
+static int dlState_reg(uint32_t hi, uint32_t lo)
+{
+	switch (hi >> 24)
+	{
+		case G_SETCOMBINE:    return 0;
+		case G_SETPRIMCOLOR:  return 1;
+		case G_SETENVCOLOR:   return 2;
+		case G_SETFOGCOLOR:   return 3;
+		case G_SETBLENDCOLOR: return 4;
+		case G_SETFILLCOLOR:  return 5;
+		case G_SETTIMG:       return 6;
+		case G_TEXTURE:       return 7;
+		case G_SETTILE:       return 8 + ((lo >> 24) & 7);
+		case G_SETTILESIZE:   return 16 + ((lo >> 24) & 7);
+	}
+	return -1;
+}
+
+/* sets the bits `mask` of a tracked value to `val`, returning
+ * true if they already were that
+ */
+static bool dlState_bits(uint32_t *known, uint32_t *v, uint32_t mask, uint32_t val)
+{
+	if (!(mask & ~*known) && !((*v ^ val) & mask))
+		return true;
 	
-	if (!mtl->gbi)
-		return success;
+	*known |= mask;
+	*v = (*v & ~mask) | (val & mask);
+	return false;
+}
+
+/* a load changes nothing if the same load is still intact in tmem and
+ * sized its tile last (the load tile itself is never drawn with, so
+ * its size doesn't matter); loads of unknown images or tiles wipe tmem
+ */
+static bool dlState_load(struct dlState *st, uint32_t hi, uint32_t lo)
+{
+	int tile = (lo >> 24) & 7;
+	uint32_t *desc = st->reg[8 + tile];
+	uint32_t *size = st->reg[16 + tile];
+	bool isKnown = ((st->regKnown >> 6) & 1) && ((st->regKnown >> (8 + tile)) & 1);
+	unsigned start = 0;
+	unsigned end = DLTMEM_SIZE;
+	int n = 0;
+	
+	if (isKnown)
+	{
+		int siz = (desc[0] >> 19) & 3;
+		
+		for (int i = 0; i < st->tmemNum; ++i)
+		{
+			if (!memcmp(st->tmem[i].timg, st->reg[6], sizeof(st->tmem[i].timg))
+				&& !memcmp(st->tmem[i].tile, desc, sizeof(st->tmem[i].tile))
+				&& st->tmem[i].load[0] == hi
+				&& st->tmem[i].load[1] == lo
+				&& (tile == G_TX_LOADTILE
+					|| (((st->regKnown >> (16 + tile)) & 1)
+						&& size[0] == hi
+						&& size[1] == lo
+					)
+				)
+			)
+				return true;
+		}
+		
+		/* where it lands; 32-bit texels are split across both
+		 * halves, so those count as all of it
+		 */
+		start = (desc[0] & 0x1FF) * 8;
+		switch (hi >> 24)
+		{
+			case G_LOADBLOCK:
+				if (siz != G_IM_SIZ_32b)
+					end = start + ((((lo >> 12) & 0xFFF) + 1) << siz) / 2;
+				break;
+			
+			/* palette entries are quadricated */
+			case G_LOADTLUT:
+				end = start + (((lo >> 14) & 0x3FF) + 1) * 8;
+				break;
+			
+			case G_LOADTILE:
+			{
+				int rows = ((int)(lo & 0xFFF) - (int)(hi & 0xFFF)) / 4 + 1;
+				
+				if (siz != G_IM_SIZ_32b && rows > 0)
+					end = start + ((desc[0] >> 9) & 0x1FF) * 8 * rows;
+				break;
+			}
+		}
+		if (end > DLTMEM_SIZE)
+		{
+			start = 0;
+			end = DLTMEM_SIZE;
+		}
+	}
 	
-	/* get baseOfs from objex */
-	FILE *docs = 0;
-	struct objex *objex = mtl->objex;
-	struct objexUdata *objexUdata = objex->udata;
-	unsigned int baseOfs = 0;
+	st->loaded = st->drawn = st->tileDrawn = true;
 	
-	if (objexUdata)
-		baseOfs = objexUdata->baseOfs;
+	/* forget the loads it overwrote */
+	for (int i = 0; i < st->tmemNum; ++i)
+		if (st->tmem[i].end <= start || st->tmem[i].start >= end)
+			st->tmem[n++] = st->tmem[i];
+	st->tmemNum = n;
 	
-	if (!(docs = getDocs(objex)))
-		return 0;
+	if (isKnown)
+	{
+		if (st->tmemNum == DLLOAD_NUM)
+			memmove(st->tmem, st->tmem + 1, --st->tmemNum * sizeof(*st->tmem));
+		n = st->tmemNum++;
+		memcpy(st->tmem[n].timg, st->reg[6], sizeof(st->tmem[n].timg));
+		memcpy(st->tmem[n].tile, desc, sizeof(st->tmem[n].tile));
+		st->tmem[n].load[0] = hi;
+		st->tmem[n].load[1] = lo;
+		st->tmem[n].start = start;
+		st->tmem[n].end = end;
+	}
 	
-	/* standalone material */
-	if (mtl->isStandalone)
+	/* loads also size the tile they use */
+	size[0] = hi;
+	size[1] = lo;
+	st->regKnown |= 1u << (16 + tile);
+	
+	return false;
+}
+
+/* applies one command to `st`, returning true if it changed nothing;
+ * calls into display lists in data[0, limit) are followed, anything
+ * else unknown forgets everything
+ */
+static bool dlState_step(
+	struct dlState *st
+	, const uint8_t *data
+	, uint32_t limit
+	, uint32_t baseOfs
+	, uint32_t hi
+	, uint32_t lo
+	, int depth
+)
+{
+	int reg = dlState_reg(hi, lo);
+	
+	switch (hi >> 24)
 	{
-		assert(objexUdata);
+		case G_SPNOOP:
+			return true;
 		
-		/* already written, load via pointer and early exit */
-		if (mtl->hasWritten)
+		/* G_NOOP may carry a tag someone is looking for */
+		case G_NOOP:
+		case G_VTX:
+			return false;
+		
+		/* anything drawn (G_LINE3D is f3dex3's G_TRISTRIP) */
+		case G_TRI1:
+		case G_TRI2:
+		case G_QUAD:
+		case G_LINE3D:
+			st->drawn = st->tileDrawn = true;
+			return false;
+		
+		case G_GEOMETRYMODE:
 		{
-			vfput64s(bin, 0xDE000000, baseOfs + mtl->useMtlOfs);
-			return success;
+			uint32_t clear = ~hi & 0xFFFFFF;
+			
+			return dlState_bits(&st->geoKnown, &st->geo, clear | lo, lo);
 		}
 		
-		/* align */
-		vfalign(bin, 8);
+		case G_SETOTHERMODE_H:
+		case G_SETOTHERMODE_L:
+		{
+			int i = (hi >> 24) == G_SETOTHERMODE_L;
+			int len = (hi & 0xFF) + 1;
+			int shift = 32 - ((hi >> 8) & 0xFF) - len;
+			uint32_t mask;
+			
+			if (shift < 0)
+			{
+				st->omKnown[i] = 0;
+				return false;
+			}
+			mask = (len >= 32) ? ~0u : ((1u << len) - 1) << shift;
+			
+			return dlState_bits(&st->omKnown[i], &st->om[i], mask, lo);
+		}
 		
-		/* not yet written */
-		mtl->hasWritten = 1;
-		mtl->useMtlOfs = vftell(bin);
+		case G_RDPSETOTHERMODE:
+		{
+			bool h = dlState_bits(&st->omKnown[0], &st->om[0], 0xFFFFFF, hi);
+			bool l = dlState_bits(&st->omKnown[1], &st->om[1], ~0u, lo);
+			
+			return h && l;
+		}
 		
-		/* print docs */
-		// fprintf(docs, DOCS_DEF "MTL_" DOCS_SPACE "  0x%08X\n"
-		// 	, Canitize(mtl->name, 1)
-		// 	, (int)vftell(bin) + baseOfs
-		// );
-		document_assign(
-			mtl->name,
-			NULL,
-			(int)vftell(bin) + baseOfs,
-			T_MTL
-		);
+		/* modelview loads without push are tracked */
+		case G_MTX:
+			if ((hi & 0xFFFFFF00) != 0xDA380000 || (hi & 0x05) != 0x01)
+				st->mtxKnown = false;
+			else if (!(hi & 0x02))
+				st->mtxKnown = false;
+			else if (st->mtxKnown && st->mtx == lo)
+				return true;
+			else
+			{
+				st->mtx = lo;
+				st->mtxKnown = true;
+			}
+			return false;
 		
-		/* texture dimensions */
-		for (int i = 0; i < 2; ++i)
+		case G_RDPLOADSYNC:
+			if (!st->loaded)
+				return true;
+			st->loaded = false;
+			return false;
+		
+		case G_RDPPIPESYNC:
+			if (!st->drawn)
+				return true;
+			st->drawn = false;
+			return false;
+		
+		case G_RDPTILESYNC:
+			if (!st->tileDrawn)
+				return true;
+			st->tileDrawn = false;
+			return false;
+		
+		case G_LOADTLUT:
+		case G_LOADBLOCK:
+		case G_LOADTILE:
+			return dlState_load(st, hi, lo);
+		
+		case G_ENDDL:
+			return false;
+		
+		/* a call (or branch) changes nothing if everything it runs
+		 * changes nothing
+		 */
+		case G_DL:
 		{
-			struct objex_texture *tex = (i == 0) ? mtl->tex0 : mtl->tex1;
-			char buf[16];
-			struct texUdata *udata;
-			int w;
-			int h;
-			
-			if (!tex || !(udata = tex->udata))
-				continue;
+			struct dlState call = *st;
+			bool isRedundant = true;
+			uint32_t at = lo - baseOfs;
 			
-			w = tex->w;
-			h = tex->h / udata->virtDiv;
+			if (depth >= 8
+				|| (lo >> 24) != (baseOfs >> 24)
+				|| lo < baseOfs
+				|| at >= limit
+				|| (at & 7)
+			)
+			{
+				dlState_forget(st);
+				return false;
+			}
 			
-			sprintf(buf, "TEXEL%d_W", i);
-			// fprintf(docs, DOCS_DEF "MTL_" DOCS_SPACE_2 " %d\n"
-			// 	, Canitize(mtl->name, 1)
-			// 	, buf
-			// 	, w
-			// );
-			document_assign(
-				mtl->name,
-				buf,
-				w,
-				T_MTL | DOC_INT
-			);
+			for (; ; at += 8)
+			{
+				uint32_t h;
+				uint32_t l;
+				
+				/* ran past what can be read */
+				if (at + 8 > limit)
+				{
+					dlState_forget(st);
+					return false;
+				}
+				
+				h = get32((void*)(data + at));
+				l = get32((void*)(data + at + 4));
+				if ((h >> 24) == G_ENDDL)
+					break;
+				if (!dlState_step(&call, data, limit, baseOfs, h, l, depth + 1))
+					isRedundant = false;
+				
+				/* branches don't return */
+				if ((h >> 24) == G_DL && (h & 0x00FF0000))
+					break;
+			}
 			
-			sprintf(buf, "TEXEL%d_H", i);
-			// fprintf(docs, DOCS_DEF "MTL_" DOCS_SPACE_2 " %d\n"
-			// 	, Canitize(mtl->name, 1)
-			// 	, buf
-			// 	, h
-			// );
-			document_assign(
-				mtl->name,
-				buf,
-				h,
-				T_MTL | DOC_INT
-			);
+			*st = call;
+			return isRedundant;
 		}
 	}
 	
-	char *sp = 0;
-	char *tok = 0;
-	char *dup = malloc(mtl->gbiLen);
-	if (!dup)
-		return errmsg(ERR_NOMEM);
-	memcpy(dup, mtl->gbi, mtl->gbiLen);
-//		debugf("gbi = '%s'\n", dup);
-	const char *delim = "\r\n";
+	if (reg >= 0)
+	{
+		/* what standalone materials document (MTL_*_PRIMCOLOR and
+		 * the like) may get patched at runtime, so it is never
+		 * redundant, and afterwards its value isn't known
+		 */
+		bool isPatched = depth > 0
+			&& ((hi >> 24) == G_SETPRIMCOLOR
+				|| (hi >> 24) == G_SETENVCOLOR
+				|| (hi >> 24) == G_SETTIMG
+				|| (hi >> 24) == G_SETTILESIZE
+			);
+		
+		if (isPatched)
+		{
+			st->regKnown &= ~(1u << reg);
+			return false;
+		}
+		
+		if (((st->regKnown >> reg) & 1)
+			&& st->reg[reg][0] == hi
+			&& st->reg[reg][1] == lo
+		)
+			return true;
+		
+		st->reg[reg][0] = hi;
+		st->reg[reg][1] = lo;
+		st->regKnown |= 1u << reg;
+		return false;
+	}
 	
-//	fprintf(stderr, "gbi = '%s'\n", dup);
-	if (!mtl_gbi_vars(mtl, dup))
-		return 0;
-//	fprintf(stderr, "change to '%s'\n", dup);
+	dlState_forget(st);
+	return false;
+}
+
+/* which of the `num` commands at data[at] change nothing when run
+ * in state `st`; syncs only matter to what runs after them
+ */
+static void dlState_delta(
+	struct dlState st
+	, const uint8_t *data
+	, uint32_t limit
+	, uint32_t baseOfs
+	, size_t at
+	, int num
+	, int depth
+	, bool *isRedundant
+)
+{
+	bool loadsRedundant = true;
+	bool restRedundant = true;
+	
+	for (int i = 0; i < num; ++i)
+		isRedundant[i] = dlState_step(&st, data, limit, baseOfs
+			, get32((void*)(data + at + i * 8))
+			, get32((void*)(data + at + i * 8 + 4))
+			, depth
+		);
 	
-	int settimg = 0;
-	int settilesize = 0;
-	for (tok = strtok_r(dup, delim, &sp)
-		; tok
-		; tok = strtok_r(0, delim, &sp)
-	)
+	for (int i = num - 1; i >= 0; --i)
 	{
-//			debugf("gbi = '%s' %p\n", mtl->gbi, mtl->gbi);
-//			debugf("gbi: '%s'\n", dup);
-		uint32_t *r;
+		switch (data[at + i * 8])
+		{
+			case G_LOADTLUT:
+			case G_LOADBLOCK:
+			case G_LOADTILE:
+				loadsRedundant &= isRedundant[i];
+				break;
+			
+			case G_RDPLOADSYNC:
+				isRedundant[i] |= loadsRedundant;
+				break;
+			
+			case G_RDPPIPESYNC:
+			case G_RDPTILESYNC:
+				isRedundant[i] |= restRedundant;
+				break;
+		}
+		restRedundant &= isRedundant[i];
+	}
+}
+
+/* relocations written between `start` and `end` move to newOfs */
+static void dlist_remap(struct objex *objex, size_t start, size_t end, const size_t *newOfs)
+{
+	struct objexUdata *udata = objex->udata;
+	
+	void remap(struct reloc *r)
+	{
+		for (; r; r = r->next)
+			if (r->offset >= start && r->offset < end)
+				r->offset = newOfs[(r->offset - start) / 8] + (r->offset - start) % 8;
+	}
+	for (struct objex_g *g = objex->g; g; g = g->next)
+		if (g->udata)
+			remap(((struct groupUdata*)g->udata)->reloc);
+	remap(udata->identityMatrixList);
+}
+
+/* relocations written between `start` and `end` go with what was
+ * there
+ */
+static void dlist_unreloc(struct objex *objex, size_t start, size_t end)
+{
+	for (struct objex_g *g = objex->g; g; g = g->next)
+	{
+		struct groupUdata *udata = g->udata;
+		struct reloc **r;
+		
+		if (!udata)
+			continue;
+		
+		for (r = &udata->reloc; *r; )
+		{
+			struct reloc *next = (*r)->next;
+			
+			if ((*r)->offset >= start && (*r)->offset < end)
+			{
+				free(*r);
+				*r = next;
+			}
+			else
+				r = &(*r)->next;
+		}
+	}
+}
+
+/* --delta-materials: the state of the group display list being
+ * written, simulated up to gDlStateOfs
+ */
+static struct dlState gDlState;
+static size_t gDlStart;
+static size_t gDlStateOfs;
+static bool gDlStateOn = false;
+
+/* simulates what the display list wrote since last time, up to `end` */
+static void gDlState_catchUp(VFILE *bin, size_t end, uint32_t baseOfs)
+{
+	const uint8_t *data = bin->data;
+	
+	for (; gDlStateOfs + 8 <= end; gDlStateOfs += 8)
+		dlState_step(&gDlState, data, gDlStart, baseOfs
+			, get32((void*)(data + gDlStateOfs))
+			, get32((void*)(data + gDlStateOfs + 4))
+			, 0
+		);
+}
+
+/* drops what an inline material wrote from `start` on that changes
+ * nothing; calls and branches stay, since they carry relocations
+ */
+static void *zobj_writeUsemtlDeltaInline(VFILE *bin, struct objex *objex, size_t start, uint32_t baseOfs)
+{
+	struct objexUdata *udata = objex->udata;
+	uint8_t *data = bin->data;
+	size_t end = vftell(bin);
+	size_t out = start;
+	int num = (end - start) / 8;
+	
+	if (!num)
+		return success;
+	
+	bool isRedundant[num];
+	size_t newOfs[num];
+	
+	dlState_delta(gDlState, data, gDlStart, baseOfs, start, num, 0, isRedundant);
+	for (int i = 0; i < num; ++i)
+	{
+		newOfs[i] = out;
+		if (isRedundant[i] && data[start + i * 8] != G_DL)
+		{
+			udata->delta.dropped += 1;
+			continue;
+		}
+		memmove(data + out, data + start + i * 8, 8);
+		out += 8;
+	}
+	
+	if (out == end)
+		return success;
+	
+	dlist_remap(objex, start, end, newOfs);
+	vfseek(bin, out, SEEK_SET);
+	vftruncate(bin);
+	
+	return success;
+}
+
+/* calls a standalone material that has been written, running only
+ * what differs from the state the display list already set: calls
+ * past a redundant start, writes a lone command inline, or writes
+ * nothing at all; colors and textures patched at runtime must be
+ * reached through the material's own commands, so are never inlined
+ */
+static void *zobj_writeUsemtlDelta(VFILE *bin, struct objex_material *mtl, uint32_t baseOfs)
+{
+	struct objexUdata *udata = mtl->objex->udata;
+	const uint8_t *data = bin->data;
+	size_t at = mtl->useMtlOfs;
+	int num = 0;
+	int first;
+	int kept = 0;
+	
+	gDlState_catchUp(bin, vftell(bin), baseOfs);
+	udata->delta.calls += 1;
+	
+	/* commands up to the end of the material */
+	for (; ; ++num)
+	{
+		const uint8_t *cmd = data + at + num * 8;
+		
+		/* ran past what can be read; call it whole */
+		if (at + num * 8 + 8 > gDlStart)
+		{
+			vfput64s(bin, 0xDE000000, baseOfs + at);
+			return success;
+		}
+		if (cmd[0] == G_ENDDL)
+			break;
+		
+		/* branches don't return */
+		if (cmd[0] == G_DL && cmd[1])
+		{
+			++num;
+			break;
+		}
+	}
+	
+	bool isRedundant[num + 1];
+	
+	dlState_delta(gDlState, data, gDlStart, baseOfs, at, num, 1, isRedundant);
+	
+	for (first = 0; first < num && isRedundant[first]; ++first)
+		;
+	for (int i = first; i < num; ++i)
+		kept += !isRedundant[i];
+	
+	/* the material changes nothing */
+	if (first == num)
+	{
+		udata->delta.omitted += 1;
+		return success;
+	}
+	
+	/* one command is as long as the call */
+	if (kept == 1)
+	{
+		switch (data[at + first * 8])
+		{
+			case G_DL:
+			case G_SETPRIMCOLOR:
+			case G_SETENVCOLOR:
+			case G_SETTIMG:
+			case G_SETTILESIZE:
+				break;
+			
+			default:
+			{
+				uint32_t hi = get32((void*)(data + at + first * 8));
+				uint32_t lo = get32((void*)(data + at + first * 8 + 4));
+				
+				vfput32(bin, hi);
+				vfput32(bin, lo);
+				udata->delta.inlined += 1;
+				return success;
+			}
+		}
+	}
+	
+	vfput64s(bin, 0xDE000000, baseOfs + at + first * 8);
+	udata->delta.skipped += first;
+	
+	return success;
+}
+
+void *zobj_writeUsemtl(VFILE *bin, struct objex_material *mtl)
+{
+	extern int deltaMaterials;
+	struct objex_texture *loaded = gLoadedAtlas;
+	struct objex_texture *atlas;
+	int skipAtlas = 0;
+	
+	/* a material may load anything into TMEM */
+	gLoadedAtlas = 0;
+	
+	if (!mtl)
+		return success;
+	
+	if (!mtl->gbi)
+		return success;
+	
+	/* get baseOfs from objex */
+	FILE *docs = 0;
+	struct objex *objex = mtl->objex;
+	struct objexUdata *objexUdata = objex->udata;
+	struct mtlUdata *mtlUdata = mtl->udata;
+	unsigned int baseOfs = 0;
+	
+	if (objexUdata)
+		baseOfs = objexUdata->baseOfs;
+	
+	if (!(docs = getDocs(objex)))
+		return 0;
+	
+	/* consecutive materials sharing an atlas skip loading it again */
+	if ((atlas = mtl_atlas(mtl)))
+	{
+		skipAtlas = (atlas == loaded);
+		
+		/* branching elsewhere may load other textures */
+		if (!strstr(mtl->gbi, "_group=\""))
+			gLoadedAtlas = atlas;
+	}
+	
+	/* standalone material */
+	if (mtl->isStandalone)
+	{
+		assert(objexUdata);
+		
+		/* already written, load via pointer and early exit */
+		if (mtl->hasWritten)
+		{
+			if (deltaMaterials && gDlStateOn)
+				return zobj_writeUsemtlDelta(bin, mtl, baseOfs);
+			
+			vfput64s(bin, 0xDE000000, baseOfs + mtl->useMtlOfs
+				+ (skipAtlas ? mtlUdata->atlasSkip : 0)
+			);
+			return success;
+		}
+		
+		/* align */
+		vfalign(bin, 8);
+		
+		/* not yet written */
+		mtl->hasWritten = 1;
+		mtl->useMtlOfs = vftell(bin);
+		
+		/* print docs */
+		// fprintf(docs, DOCS_DEF "MTL_" DOCS_SPACE "  0x%08X\n"
+		// 	, Canitize(mtl->name, 1)
+		// 	, (int)vftell(bin) + baseOfs
+		// );
+		document_assign(
+			mtl->name,
+			NULL,
+			(int)vftell(bin) + baseOfs,
+			T_MTL
+		);
+		
+		/* texture dimensions */
+		for (int i = 0; i < 2; ++i)
+		{
+			struct objex_texture *tex = (i == 0) ? mtl->tex0 : mtl->tex1;
+			char buf[16];
+			struct texUdata *udata;
+			int w;
+			int h;
+			
+			if (!tex || !(udata = tex->udata))
+				continue;
+			
+			w = tex->w;
+			h = tex->h / udata->virtDiv;
+			
+			sprintf(buf, "TEXEL%d_W", i);
+			// fprintf(docs, DOCS_DEF "MTL_" DOCS_SPACE_2 " %d\n"
+			// 	, Canitize(mtl->name, 1)
+			// 	, buf
+			// 	, w
+			// );
+			document_assign(
+				mtl->name,
+				buf,
+				w,
+				T_MTL | DOC_INT
+			);
+			
+			sprintf(buf, "TEXEL%d_H", i);
+			// fprintf(docs, DOCS_DEF "MTL_" DOCS_SPACE_2 " %d\n"
+			// 	, Canitize(mtl->name, 1)
+			// 	, buf
+			// 	, h
+			// );
+			document_assign(
+				mtl->name,
+				buf,
+				h,
+				T_MTL | DOC_INT
+			);
+		}
+	}
+	
+	char *sp = 0;
+	char *tok = 0;
+	char prefix[512] = "";
+	char *dup;
+	size_t prefixLen;
+	size_t start = vftell(bin);
+	
+	/* the atlas gets loaded first, so consecutive materials
+	 * sharing it can branch past that part
+	 */
+	if (atlas && (mtl->isStandalone || !skipAtlas))
+		atlas_load(prefix, atlas);
+	prefixLen = strlen(prefix);
+	mtlUdata->atlasSkip = 0;
+	
+	if (!(dup = malloc(prefixLen + mtl->gbiLen)))
+		return errmsg(ERR_NOMEM);
+	memcpy(dup, prefix, prefixLen);
+	memcpy(dup + prefixLen, mtl->gbi, mtl->gbiLen);
+//		debugf("gbi = '%s'\n", dup);
+	const char *delim = "\r\n";
+	
+//	fprintf(stderr, "gbi = '%s'\n", dup);
+	if (!mtl_gbi_vars(mtl, dup + prefixLen))
+		return 0;
+//	fprintf(stderr, "change to '%s'\n", dup);
+	
+	int settimg = 0;
+	int settilesize = 0;
+	for (tok = strtok_r(dup, delim, &sp)
+		; tok
+		; tok = strtok_r(0, delim, &sp)
+	)
+	{
+		if (prefixLen && !mtlUdata->atlasSkip && tok >= dup + prefixLen)
+			mtlUdata->atlasSkip = vftell(bin) - start;
+//			debugf("gbi = '%s' %p\n", mtl->gbi, mtl->gbi);
+//			debugf("gbi: '%s'\n", dup);
+		uint32_t *r;
 //		fprintf(stderr, "exec '%s'\n", tok);
-		if ((r = f3dex2_exec(tok)))
+		if ((r = gUcode->gbi(tok)))
 			do
 			{
 //					debugf("%08X %08X\n", r[0], r[1]);
@@ -1312,22 +2116,1951 @@ void *zobj_writeUsemtl(VFILE *bin, struct objex_material *mtl)
 				vfput32(bin, r[0]);
 				vfput32(bin, r[1]);
 			}
-			while ((r = f3dex2_exec(tok)));
-		else if (gfxasm_fatal())
+			while ((r = gUcode->gbi(tok)));
+		else if (gfxasm_fatal())
+		{
+			free(dup);
+			return errmsg("%s", gfxasm_error());
+		}
+	}
+	free(dup);
+	
+	/* standalone must end in DF command */
+	if (mtl->isStandalone)
+		vfput64s(bin, 0xDF000000, 0x00000000);
+	
+	/* inline ones write only what changes */
+	else if (deltaMaterials && gDlStateOn)
+	{
+		gDlState_catchUp(bin, start, baseOfs);
+		if (!zobj_writeUsemtlDeltaInline(bin, objex, start, baseOfs))
+			return 0;
+	}
+	
+	return success;
+}
+
+/* the commands a material's gbi assembles to, as hi, lo pairs, with
+ * the atlas load written ahead of it if `withAtlas`; 0 if it can't be
+ * assembled; the caller frees the result
+ */
+static uint32_t *mtl_commands(struct objex_material *mtl, bool withAtlas, int *num)
+{
+	struct objex_texture *atlas;
+	char prefix[512] = "";
+	size_t prefixLen;
+	uint32_t *cmd = 0;
+	int max = 0;
+	char *dup;
+	char *sp = 0;
+	
+	*num = 0;
+	if (!mtl->gbi)
+		return 0;
+	
+	if (withAtlas && (atlas = mtl_atlas(mtl)))
+		atlas_load(prefix, atlas);
+	prefixLen = strlen(prefix);
+	
+	if (!(dup = malloc(prefixLen + mtl->gbiLen + 1)))
+		return errmsg(ERR_NOMEM);
+	memcpy(dup, prefix, prefixLen);
+	memcpy(dup + prefixLen, mtl->gbi, mtl->gbiLen);
+	dup[prefixLen + mtl->gbiLen] = '\0';
+	
+	if (!mtl_gbi_vars(mtl, dup + prefixLen))
+	{
+		free(dup);
+		return 0;
+	}
+	
+	for (char *tok = strtok_r(dup, "\r\n", &sp); tok; tok = strtok_r(0, "\r\n", &sp))
+	{
+		uint32_t *r;
+		
+		if (!(r = gUcode->gbi(tok)))
+		{
+			if (!gfxasm_fatal())
+				continue;
+			free(cmd);
+			free(dup);
+			return errmsg("%s", gfxasm_error());
+		}
+		
+		do
+		{
+			if (*num == max)
+			{
+				uint32_t *grown;
+				
+				max = max ? max * 2 : 16;
+				if (!(grown = realloc(cmd, max * 2 * sizeof(*cmd))))
+				{
+					free(cmd);
+					free(dup);
+					return errmsg(ERR_NOMEM);
+				}
+				cmd = grown;
+			}
+			cmd[*num * 2] = r[0];
+			cmd[*num * 2 + 1] = r[1];
+			*num += 1;
+		} while ((r = gUcode->gbi(tok)));
+	}
+	free(dup);
+	
+	/* assembled to nothing */
+	if (!cmd)
+		return malloc(sizeof(*cmd));
+	
+	return cmd;
+}
+
+struct mtlUse
+{
+	const void *bone;
+	int face; /* order drawn in */
+	int mtl;
+};
+
+static int qsortfunc_mtlUse(const void *a_, const void *b_)
+{
+	const struct mtlUse *a = a_;
+	const struct mtlUse *b = b_;
+	
+	if (a->bone != b->bone)
+		return (uintptr_t)a->bone < (uintptr_t)b->bone ? -1 : 1;
+	return a->face - b->face;
+}
+
+/* --auto-standalone: materials not marked standalone are called only
+ * where that is smaller than writing them at every use; a use is
+ * counted wherever a mesh group (or limb, if it gets split) changes
+ * to the material, as that is where it gets written; those shared
+ * between files are left called
+ */
+void *zobj_chooseStandalone(struct objex *objex, int isMesh(struct objex_g *g))
+{
+	struct objexUdata *udata = objex->udata;
+	struct objex_v *v = objex->v;
+	int *uses;
+	
+	if (!(uses = calloc(objex->mtlNum, sizeof(*uses))))
+		return errmsg(ERR_NOMEM);
+	
+	for (struct objex_g *g = objex->g; g; g = g->next)
+	{
+		struct mtlUse *use;
+		int num = 0;
+		
+		if (!g->fNum || g->noMtl || !isMesh(g))
+			continue;
+		
+		if (!(use = malloc(g->fNum * sizeof(*use))))
+		{
+			free(uses);
+			return errmsg(ERR_NOMEM);
+		}
+		
+		/* skinned groups get divided between limbs */
+		for (struct objex_f *f = g->f; f < g->f + g->fNum; ++f)
+		{
+			struct objex_v *one = &v[f->v.x];
+			
+			if (!f->mtl)
+				continue;
+			use[num].mtl = f->mtl->index;
+			use[num].bone = (g->hasWeight && one->weight) ? one->weight->bone : 0;
+			use[num].face = f - g->f;
+			++num;
+		}
+		
+		/* each limb's faces in the order they're drawn */
+		qsort(use, num, sizeof(*use), qsortfunc_mtlUse);
+		for (int i = 0; i < num; ++i)
+			if (!i
+				|| use[i].bone != use[i - 1].bone
+				|| use[i].mtl != use[i - 1].mtl
+			)
+				uses[use[i].mtl] += 1;
+		free(use);
+	}
+	
+	for (struct objex_material *mtl = objex->mtl; mtl; mtl = mtl->next)
+	{
+		int n = uses[mtl->index];
+		uint32_t *cmd;
+		int bytes;
+		int called;
+		int inlined;
+		
+		/* materials shared between files, or drawn with only from
+		 * elsewhere, get called from display lists not counted here
+		 */
+		if (!mtl->isStandalone
+			|| mtl->isStandaloneMarked
+			|| mtl->isMultiFile
+			|| !n
+			|| !mtl->isUsed
+			|| !mtl->gbi
+			|| !(cmd = mtl_commands(mtl, true, &bytes))
+		)
+			continue;
+		free(cmd);
+		bytes *= 8;
+		
+		/* the body and its end command once, a call at every use */
+		called = bytes + 8 + n * 8;
+		inlined = bytes * n;
+		
+		if (called < inlined)
+		{
+			udata->standalone.called += 1;
+			continue;
+		}
+		
+		mtl->isStandalone = 0;
+		udata->standalone.inlined += 1;
+		udata->standalone.bytesSaved += called - inlined;
+	}
+	
+	free(uses);
+	return success;
+}
+
+/* one corner of a face, identified by the attributes it indexes */
+struct vcacheCorner
+{
+	int v;
+	int vt;
+	int vn;
+	int vc;
+	int corner; /* face * 3 + which */
+};
+
+static int vec3i_at(const struct objex_vec3i *v, int which)
+{
+	return which == 0 ? v->x : which == 1 ? v->y : v->z;
+}
+
+/* how many vertices of a face aren't in the current batch yet */
+static int vcache_fresh(const int t[3], const int *stamp, int batchId)
+{
+	int fresh = 0;
+	
+	for (int k = 0; k < 3; ++k)
+		fresh += stamp[t[k]] != batchId
+			&& (k < 1 || t[k] != t[0])
+			&& (k < 2 || t[k] != t[1])
+		;
+	return fresh;
+}
+
+static int qsortfunc_vcacheCorner(const void *a_, const void *b_)
+{
+	const struct vcacheCorner *a = a_;
+	const struct vcacheCorner *b = b_;
+	
+	if (a->v != b->v)
+		return a->v - b->v;
+	if (a->vt != b->vt)
+		return a->vt - b->vt;
+	if (a->vn != b->vn)
+		return a->vn - b->vn;
+	return a->vc - b->vc;
+}
+
+/* estimated bytes for writing faces in the given order, filling and
+ * flushing the vertex buffer like zobj_writeDlist does: vertex data,
+ * a gSPVertex (and likely matrix) per bone per flush, triangle pairs;
+ * `uploads` receives how many vertices get loaded
+ */
+static unsigned vcache_cost(
+	const int (*tri)[3]
+	, const int *order
+	, int num
+	, const void *const *key
+	, int *stamp
+	, int *stampLast
+	, int *uploads
+)
+{
+	int batch[UCODE_VBUF_CAP];
+	int batchNum = 0;
+	int batchTris = 0;
+	int batchId = ++*stampLast;
+	unsigned cost = 0;
+	
+	*uploads = 0;
+	
+	void flush(void)
+	{
+		int keys = 0;
+		
+		for (int i = 0; i < batchNum; ++i)
+		{
+			int k;
+			for (k = 0; k < i; ++k)
+				if (key[batch[k]] == key[batch[i]])
+					break;
+			keys += (k == i);
+		}
+		cost += batchNum * 16 + keys * 16 + ((batchTris + 1) / 2) * 8;
+		*uploads += batchNum;
+		batchNum = 0;
+		batchTris = 0;
+		batchId = ++*stampLast;
+	}
+	
+	for (int i = 0; i < num; ++i)
+	{
+		const int *t = tri[order ? order[i] : i];
+		
+		if (batchNum + vcache_fresh(t, stamp, batchId) > gUcode->vbufMax)
+			flush();
+		for (int k = 0; k < 3; ++k)
+		{
+			if (stamp[t[k]] == batchId)
+				continue;
+			stamp[t[k]] = batchId;
+			batch[batchNum++] = t[k];
+		}
+		batchTris += 1;
+	}
+	if (batchNum)
+		flush();
+	
+	return cost;
+}
+
+/* reorders the faces of one material run so each vertex buffer load
+ * serves as many triangles as it can: a batch grows by whichever face
+ * touching it adds the fewest new vertices, preferring vertices with
+ * few faces left, and is seeded by the next face in original order;
+ * the new order is kept only if it is estimated to be smaller
+ */
+static void *vcache_reorderRun(
+	struct objex *objex
+	, struct objex_f *f
+	, int num
+	, int *uploadsBefore
+	, int *uploadsAfter
+)
+{
+	struct vcacheCorner *corner = 0;
+	const void **key = 0;
+	int (*tri)[3] = 0;
+	int *adjStart = 0;
+	int *adj = 0;
+	int *live = 0;
+	int *stamp = 0;
+	int *order = 0;
+	char *done = 0;
+	struct objex_f *tmp = 0;
+	void *rv = success;
+	int stampLast = 0;
+	int vNum = 0;
+	int i;
+	int k;
+	
+	if (!(corner = malloc(num * 3 * sizeof(*corner)))
+		|| !(tri = malloc(num * sizeof(*tri)))
+		|| !(order = malloc(num * sizeof(*order)))
+		|| !(done = calloc(num, sizeof(*done)))
+	)
+		goto L_nomem;
+	
+	/* identify distinct vertices */
+	for (i = 0; i < num * 3; ++i)
+	{
+		const struct objex_f *face = &f[i / 3];
+		
+		corner[i].v = vec3i_at(&face->v, i % 3);
+		corner[i].vt = vec3i_at(&face->vt, i % 3);
+		corner[i].vn = vec3i_at(&face->vn, i % 3);
+		corner[i].vc = vec3i_at(&face->vc, i % 3);
+		corner[i].corner = i;
+	}
+	qsort(corner, num * 3, sizeof(*corner), qsortfunc_vcacheCorner);
+	for (i = 0; i < num * 3; ++i)
+	{
+		if (i && qsortfunc_vcacheCorner(&corner[i - 1], &corner[i]))
+			++vNum;
+		tri[corner[i].corner / 3][corner[i].corner % 3] = vNum;
+	}
+	++vNum;
+	
+	if (!(key = calloc(vNum, sizeof(*key)))
+		|| !(stamp = calloc(vNum, sizeof(*stamp)))
+		|| !(live = calloc(vNum, sizeof(*live)))
+		|| !(adjStart = calloc(vNum + 1, sizeof(*adjStart)))
+		|| !(adj = malloc(num * 3 * sizeof(*adj)))
+	)
+		goto L_nomem;
+	
+	/* vertices get loaded per bone, so batches mixing bones cost more */
+	for (i = 0; i < num * 3; ++i)
+	{
+		struct objex_v *v = &objex->v[corner[i].v];
+		
+		if (v->weight)
+			key[tri[corner[i].corner / 3][corner[i].corner % 3]] = v->weight->bone;
+	}
+	
+	/* faces using each vertex */
+	for (i = 0; i < num; ++i)
+		for (k = 0; k < 3; ++k)
+			adjStart[tri[i][k] + 1] += 1;
+	for (i = 0; i < vNum; ++i)
+	{
+		live[i] = adjStart[i + 1];
+		adjStart[i + 1] += adjStart[i];
+	}
+	for (i = 0; i < num; ++i)
+		for (k = 0; k < 3; ++k)
+			adj[adjStart[tri[i][k]] + --live[tri[i][k]]] = i;
+	for (i = 0; i < vNum; ++i)
+		live[i] = adjStart[i + 1] - adjStart[i];
+	
+	/* grow batches */
+	{
+		int batch[UCODE_VBUF_CAP];
+		int batchNum = 0;
+		int batchId = ++stampLast;
+		int emitted = 0;
+		int cursor = 0;
+		
+		while (emitted < num)
+		{
+			int best = -1;
+			int bestFresh = 4;
+			int bestLive = INT_MAX;
+			
+			/* faces touching the batch */
+			for (i = 0; i < batchNum; ++i)
+			{
+				int v = batch[i];
+				
+				for (k = adjStart[v]; k < adjStart[v + 1]; ++k)
+				{
+					int face = adj[k];
+					int fresh;
+					int faceLive;
+					
+					if (done[face])
+						continue;
+					fresh = vcache_fresh(tri[face], stamp, batchId);
+					if (batchNum + fresh > gUcode->vbufMax || fresh > bestFresh)
+						continue;
+					faceLive = live[tri[face][0]] + live[tri[face][1]] + live[tri[face][2]];
+					if (fresh < bestFresh || faceLive < bestLive)
+					{
+						best = face;
+						bestFresh = fresh;
+						bestLive = faceLive;
+					}
+				}
+			}
+			
+			/* nothing touching it fits, so seed elsewhere */
+			if (best < 0)
+			{
+				while (done[cursor])
+					++cursor;
+				if (batchNum + vcache_fresh(tri[cursor], stamp, batchId) <= gUcode->vbufMax)
+					best = cursor;
+			}
+			
+			/* batch is full */
+			if (best < 0)
+			{
+				batchNum = 0;
+				batchId = ++stampLast;
+				continue;
+			}
+			
+			done[best] = 1;
+			order[emitted++] = best;
+			for (k = 0; k < 3; ++k)
+			{
+				int v = tri[best][k];
+				
+				live[v] -= 1;
+				if (stamp[v] == batchId)
+					continue;
+				stamp[v] = batchId;
+				batch[batchNum++] = v;
+			}
+		}
+	}
+	
+	/* keep whichever order is cheaper */
+	{
+		int before;
+		int after;
+		unsigned costBefore = vcache_cost((const void*)tri, 0, num, key, stamp, &stampLast, &before);
+		unsigned costAfter = vcache_cost((const void*)tri, order, num, key, stamp, &stampLast, &after);
+		
+		*uploadsBefore += before;
+		if (costAfter >= costBefore)
+		{
+			*uploadsAfter += before;
+			goto L_cleanup;
+		}
+		*uploadsAfter += after;
+		
+		if (!(tmp = malloc(num * sizeof(*tmp))))
+			goto L_nomem;
+		memcpy(tmp, f, num * sizeof(*tmp));
+		for (i = 0; i < num; ++i)
+			f[i] = tmp[order[i]];
+	}
+	
+	goto L_cleanup;
+L_nomem:
+	rv = errmsg(ERR_NOMEM);
+L_cleanup:
+	free(corner);
+	free(key);
+	free(tri);
+	free(adjStart);
+	free(adj);
+	free(live);
+	free(stamp);
+	free(order);
+	free(done);
+	free(tmp);
+	return rv;
+}
+
+/* whether a material blends with what's already drawn, in which case
+ * the order its triangles are drawn in is visible; decided from the
+ * render mode it assembles to, not the macros it is written with:
+ * forced blending, or reading the framebuffer without updating depth
+ */
+static bool mtl_isBlended(struct objex_material *mtl)
+{
+	struct mtlUdata *mtlUdata;
+	uint32_t othermode = 0;
+	uint32_t known = 0;
+	uint32_t *cmd;
+	int num;
+	bool rv = false;
+	
+	if (!mtl || !mtl->gbi)
+		return false;
+	
+	/* assembled once per material */
+	if ((mtlUdata = mtl->udata) && mtlUdata->blend)
+		return mtlUdata->blend == 2;
+	
+	/* can't be assembled: assume blending, keeping the modeled order */
+	if (!(cmd = mtl_commands(mtl, false, &num)))
+		return true;
+	
+	for (int i = 0; i < num; ++i)
+	{
+		uint32_t hi = cmd[i * 2];
+		uint32_t mask = 0xFFFFFFFF;
+		
+		if ((hi >> 24) == G_SETOTHERMODE_L)
+		{
+			int len = (hi & 0xFF) + 1;
+			int shift = 32 - ((hi >> 8) & 0xFF) - len;
+			
+			if (len < 32)
+				mask = ((1u << len) - 1) << shift;
+		}
+		else if ((hi >> 24) != G_RDPSETOTHERMODE)
+			continue;
+		
+		othermode = (othermode & ~mask) | (cmd[i * 2 + 1] & mask);
+		known |= mask;
+	}
+	free(cmd);
+	
+	/* a render mode left as it was is assumed not to blend */
+	if (known & FORCE_BL & othermode)
+		rv = true;
+	if ((known & (IM_RD | Z_UPD)) == (IM_RD | Z_UPD)
+		&& (othermode & (IM_RD | Z_UPD)) == IM_RD
+	)
+		rv = true;
+	if ((known & ZMODE_DEC) == ZMODE_DEC
+		&& (othermode & ZMODE_DEC) == ZMODE_XLU
+	)
+		rv = true;
+	
+	if (mtlUdata)
+		mtlUdata->blend = rv ? 2 : 1;
+	
+	return rv;
+}
+
+/* reorders a group's faces for fewer vertex loads (--reorder-triangles),
+ * one material run at a time so material changes stay where they are;
+ * translucent runs keep the order they were modeled in
+ */
+static void *vcache_reorder(struct objex_g *g, FILE *docs)
+{
+	int uploadsBefore = 0;
+	int uploadsAfter = 0;
+	int triangles = 0;
+	struct objex_f *f;
+	struct objex_f *end = g->f + g->fNum;
+	
+	for (f = g->f; f < end; )
+	{
+		struct objex_f *run = f;
+		bool isBlended = mtl_isBlended(f->mtl);
+		
+		/* noMtl groups are flushed only when the buffer fills */
+		while (++f < end && (g->noMtl || f->mtl == run->mtl))
+			isBlended |= mtl_isBlended(f->mtl);
+		
+		/* empties write no geometry */
+		if ((!g->noMtl && run->mtl && run->mtl->isEmpty) || isBlended)
+			continue;
+		
+		if (!vcache_reorderRun(g->objex, run, f - run, &uploadsBefore, &uploadsAfter))
+			return 0;
+		triangles += f - run;
+	}
+	
+	if (triangles)
+		fprintf(docs, "/* group '%s': %d triangles, %.2f -> %.2f vertices loaded per triangle */\n"
+			, g->name
+			, triangles
+			, (double)uploadsBefore / triangles
+			, (double)uploadsAfter / triangles
+		);
+	
+	return success;
+}
+
+/* --batch-limbs: a face's place is decided by the matrices its
+ * vertices use, lowest first; matrix indices follow the skeleton
+ * depth first, so parents come before their children
+ */
+struct limbKey
+{
+	int lo;  /* lowest matrix index used */
+	int hi;  /* highest */
+	int at;  /* position in original order */
+};
+#define limbKey_lt(a, b) ((a).lo != (b).lo ? (a).lo < (b).lo : (a).hi < (b).hi)
+KSORT_INIT(limbKey, struct limbKey, limbKey_lt)
+
+/* orders the faces of each material run of a skinned group by limb
+ * (--batch-limbs), so vertex batches each need few matrices, and the
+ * next batch mostly starts on the matrix the last one left loaded;
+ * faces using the same matrices keep the order they were in
+ */
+static void *limbOrder_group(struct objex_g *g)
+{
+	struct objexUdata *udata = g->objex->udata;
+	struct objex_v *v = g->objex->v;
+	struct objex_f *end = g->f + g->fNum;
+	struct limbKey *key;
+	struct objex_f *tmp;
+	bool isReordered = false;
+	
+	if (!(key = malloc(g->fNum * sizeof(*key)))
+		|| !(tmp = malloc(g->fNum * sizeof(*tmp)))
+	)
+	{
+		free(key);
+		return errmsg(ERR_NOMEM);
+	}
+	
+	for (struct objex_f *f = g->f; f < end; )
+	{
+		struct objex_f *run = f;
+		bool isBlended = mtl_isBlended(f->mtl);
+		int num;
+		
+		/* noMtl groups are flushed only when the buffer fills */
+		while (++f < end && (g->noMtl || f->mtl == run->mtl))
+			isBlended |= mtl_isBlended(f->mtl);
+		num = f - run;
+		
+		/* empties write no geometry */
+		if ((!g->noMtl && run->mtl && run->mtl->isEmpty) || isBlended)
+			continue;
+		
+		for (int i = 0; i < num; ++i)
+		{
+			struct objex_bone *b[] = {
+				v_matrixBone(&v[run[i].v.x])
+				, v_matrixBone(&v[run[i].v.y])
+				, v_matrixBone(&v[run[i].v.z])
+			};
+			
+			key[i].lo = INT_MAX;
+			key[i].hi = -1;
+			key[i].at = i;
+			for (int k = 0; k < 3; ++k)
+			{
+				int m = b[k] ? ((struct boneUdata*)b[k]->udata)->matrixIndex : -1;
+				
+				if (m < key[i].lo)
+					key[i].lo = m;
+				if (m > key[i].hi)
+					key[i].hi = m;
+			}
+		}
+		ks_mergesort(limbKey, num, key, 0);
+		
+		memcpy(tmp, run, num * sizeof(*tmp));
+		for (int i = 0; i < num; ++i)
+		{
+			isReordered |= key[i].at != i;
+			run[i] = tmp[key[i].at];
+		}
+	}
+	
+	udata->limbs.groups += isReordered;
+	free(key);
+	free(tmp);
+	return success;
+}
+
+/* --order-materials: materials are ordered within each group so
+ * consecutive ones share textures, palettes and combiners; costs are
+ * estimated rdp cycles spent switching to a material, of which loads
+ * already in tmem can be skipped (by an atlas, or --delta-materials)
+ */
+#define DRAWORDER_EXACT 10 /* runs ordered exactly, above that greedily */
+#define DRAWORDER_SETUP 32 /* cycles setting up one load */
+#define DRAWORDER_MODE  8  /* cycles of a combiner change */
+
+struct drawRun
+{
+	struct objex_f *f;
+	int num;
+	struct objex_material *mtl;
+};
+
+/* texture `which` a material loads, where it is loaded from */
+static struct objex_texture *mtl_loadTex(struct objex_material *mtl, int which)
+{
+	struct objex_texture *tex = which ? mtl->tex1 : mtl->tex0;
+	struct objex_texture *atlas;
+	
+	if (!which && (atlas = mtl_atlas(mtl)))
+		return atlas;
+	if (tex && tex->aliasOf)
+		tex = tex->aliasOf;
+	if (tex && tex->commonRef)
+		tex = tex->commonRef;
+	
+	return tex;
+}
+
+static bool palette_same(struct objex_palette *a, struct objex_palette *b)
+{
+	if (!a || !b)
+		return a == b;
+	
+	return (a->pooled ? a->pooled : a) == (b->pooled ? b->pooled : b)
+		&& a->pooledOfs == b->pooledOfs
+		&& a->colorsNum == b->colorsNum
+	;
+}
+
+/* the line of a material's gbi containing `what`, or 0 */
+static const char *mtl_gbiLine(struct objex_material *mtl, const char *what, int *len)
+{
+	const char *line;
+	
+	if (!mtl->gbi || !(line = strstr(mtl->gbi, what)))
+		return 0;
+	
+	while (line > mtl->gbi && line[-1] != '\n')
+		--line;
+	*len = strcspn(line, "\r\n");
+	
+	return line;
+}
+
+static unsigned drawOrder_cost(struct objex_material *prev, struct objex_material *mtl)
+{
+	unsigned cost = 0;
+	const char *a;
+	const char *b;
+	int aLen;
+	int bLen;
+	
+	if (prev == mtl)
+		return 0;
+	
+	for (int i = 0; i < 2; ++i)
+	{
+		struct objex_texture *tex = mtl_loadTex(mtl, i);
+		struct objex_texture *was = prev ? mtl_loadTex(prev, i) : 0;
+		struct texUdata *udata;
+		
+		if (!tex || !(udata = tex->udata))
+			continue;
+		
+		/* a load block writes 8 bytes of tmem a cycle */
+		if (tex != was)
+			cost += DRAWORDER_SETUP + udata->fileSz / udata->virtDiv / 8;
+		
+		/* palette entries are quadricated, four writes each */
+		if (tex->palette && (!was || !palette_same(tex->palette, was->palette)))
+			cost += DRAWORDER_SETUP + tex->palette->colorsNum * 4;
+	}
+	
+	b = mtl_gbiLine(mtl, "SetCombine", &bLen);
+	a = prev ? mtl_gbiLine(prev, "SetCombine", &aLen) : 0;
+	if (b && (!a || aLen != bLen || memcmp(a, b, aLen)))
+		cost += DRAWORDER_MODE;
+	
+	return cost;
+}
+
+/* cost of drawing runs in order `ord`, starting after `prev` */
+static unsigned drawOrder_pathCost(const unsigned *cost, int num, const int *ord)
+{
+	unsigned total = cost[num * num + ord[0]];
+	
+	for (int i = 1; i < num; ++i)
+		total += cost[ord[i - 1] * num + ord[i]];
+	
+	return total;
+}
+
+/* finds the cheapest order to draw `num` runs in, a shortest path
+ * through all of them; cost[i * num + j] is switching from run i to
+ * run j, and cost[num * num + j] starting with run j
+ */
+static void *drawOrder_solve(const unsigned *cost, int num, int *ord)
+{
+	/* exactly: cheapest path over each subset ending in each run */
+	if (num <= DRAWORDER_EXACT)
+	{
+		int full = (1 << num) - 1;
+		unsigned *best;
+		signed char *from;
+		int last = 0;
+		
+		if (!(best = malloc((full + 1) * num * sizeof(*best)))
+			|| !(from = malloc((full + 1) * num))
+		)
+		{
+			free(best);
+			return errmsg(ERR_NOMEM);
+		}
+		
+		for (int mask = 1; mask <= full; ++mask)
+		{
+			for (int j = 0; j < num; ++j)
+			{
+				unsigned *b = best + mask * num + j;
+				int rest = mask & ~(1 << j);
+				
+				*b = ~0u;
+				if (!(mask & (1 << j)))
+					continue;
+				if (!rest)
+				{
+					*b = cost[num * num + j];
+					from[mask * num + j] = -1;
+					continue;
+				}
+				for (int i = 0; i < num; ++i)
+				{
+					unsigned c = best[rest * num + i];
+					
+					if (c == ~0u)
+						continue;
+					c += cost[i * num + j];
+					if (c < *b)
+					{
+						*b = c;
+						from[mask * num + j] = i;
+					}
+				}
+			}
+		}
+		
+		for (int j = 1; j < num; ++j)
+			if (best[full * num + j] < best[full * num + last])
+				last = j;
+		for (int mask = full, i = num - 1; i >= 0; --i)
+		{
+			int prev = from[mask * num + last];
+			
+			ord[i] = last;
+			mask &= ~(1 << last);
+			last = prev;
+		}
+		
+		free(best);
+		free(from);
+		return success;
+	}
+	
+	/* greedily: nearest run next, then reverse stretches of the
+	 * path while that makes it cheaper
+	 */
+	bool isUsed[num];
+	bool isBetter = true;
+	
+	memset(isUsed, 0, sizeof(isUsed));
+	for (int i = 0; i < num; ++i)
+	{
+		int next = -1;
+		
+		for (int j = 0; j < num; ++j)
+		{
+			const unsigned *row = cost + (i ? ord[i - 1] : num) * num;
+			
+			if (!isUsed[j] && (next < 0 || row[j] < row[next]))
+				next = j;
+		}
+		ord[i] = next;
+		isUsed[next] = true;
+	}
+	
+	while (isBetter)
+	{
+		unsigned now = drawOrder_pathCost(cost, num, ord);
+		
+		isBetter = false;
+		for (int i = 0; i < num - 1 && !isBetter; ++i)
+		{
+			for (int j = i + 1; j < num && !isBetter; ++j)
+			{
+				int try[num];
+				
+				memcpy(try, ord, sizeof(try));
+				for (int k = 0; k <= j - i; ++k)
+					try[i + k] = ord[j - k];
+				if (drawOrder_pathCost(cost, num, try) < now)
+				{
+					memcpy(ord, try, sizeof(try));
+					isBetter = true;
+				}
+			}
+		}
+	}
+	
+	return success;
+}
+
+/* orders one stretch of runs free to be drawn in any order */
+static void *drawOrder_stretch(
+	struct objexUdata *udata
+	, struct drawRun *run
+	, int num
+	, struct objex_material *prev
+	, bool *isReordered
+)
+{
+	unsigned *cost;
+	int ord[num];
+	int same[num];
+	unsigned before;
+	unsigned after;
+	
+	if (num < 2)
+		return success;
+	
+	if (!(cost = malloc((num + 1) * num * sizeof(*cost))))
+		return errmsg(ERR_NOMEM);
+	
+	for (int i = 0; i <= num; ++i)
+		for (int j = 0; j < num; ++j)
+			cost[i * num + j] = drawOrder_cost(i < num ? run[i].mtl : prev, run[j].mtl);
+	
+	for (int i = 0; i < num; ++i)
+		same[i] = i;
+	before = drawOrder_pathCost(cost, num, same);
+	
+	if (!drawOrder_solve(cost, num, ord))
+	{
+		free(cost);
+		return 0;
+	}
+	after = drawOrder_pathCost(cost, num, ord);
+	free(cost);
+	
+	/* ties keep the order they were modeled in */
+	if (after >= before)
+		after = before;
+	else
+	{
+		struct objex_f *start = run[0].f;
+		struct objex_f *tmp;
+		struct drawRun was[num];
+		int total = 0;
+		
+		for (int i = 0; i < num; ++i)
+			total += run[i].num;
+		if (!(tmp = malloc(total * sizeof(*tmp))))
+			return errmsg(ERR_NOMEM);
+		
+		memcpy(was, run, sizeof(was));
+		for (int i = 0, at = 0; i < num; ++i)
+		{
+			memcpy(tmp + at, was[ord[i]].f, was[ord[i]].num * sizeof(*tmp));
+			run[i].f = start + at;
+			run[i].num = was[ord[i]].num;
+			run[i].mtl = was[ord[i]].mtl;
+			at += run[i].num;
+		}
+		memcpy(start, tmp, total * sizeof(*tmp));
+		free(tmp);
+		*isReordered = true;
+	}
+	
+	udata->drawOrder.before += before;
+	udata->drawOrder.after += after;
+	
+	return success;
+}
+
+/* the rsp and rdp state a material run sets; what it doesn't set it
+ * inherits from whichever run is drawn before it
+ */
+struct drawState
+{
+	uint32_t reg; /* combiner and color registers, as dlState_reg */
+	uint32_t geo; /* geometry mode bits */
+	uint32_t om[2]; /* othermode high, low bits */
+};
+
+static void drawState_of(struct objex_material *mtl, struct drawState *set)
+{
+	uint32_t *cmd;
+	int num;
+	
+	memset(set, 0, sizeof(*set));
+	
+	/* empties, and what can't be assembled, set nothing known */
+	if (!mtl || mtl->isEmpty || !(cmd = mtl_commands(mtl, false, &num)))
+		return;
+	
+	for (int i = 0; i < num; ++i)
+	{
+		uint32_t hi = cmd[i * 2];
+		uint32_t lo = cmd[i * 2 + 1];
+		int reg = dlState_reg(hi, lo);
+		
+		/* textures are loaded by each material using them */
+		if (reg >= 0 && reg <= 7 && reg != 6)
+			set->reg |= 1u << reg;
+		
+		switch (hi >> 24)
+		{
+			case G_GEOMETRYMODE:
+				set->geo |= (~hi & 0xFFFFFF) | lo;
+				break;
+			
+			case G_SETOTHERMODE_H:
+			case G_SETOTHERMODE_L:
+			{
+				int len = (hi & 0xFF) + 1;
+				int shift = 32 - ((hi >> 8) & 0xFF) - len;
+				
+				set->om[(hi >> 24) == G_SETOTHERMODE_L] |=
+					(len >= 32 || shift < 0) ? ~0u : ((1u << len) - 1) << shift;
+				break;
+			}
+			
+			case G_RDPSETOTHERMODE:
+				set->om[0] |= 0xFFFFFF;
+				set->om[1] = ~0u;
+				break;
+		}
+	}
+	free(cmd);
+}
+
+/* whether `a` sets everything `b` does */
+static bool drawState_covers(const struct drawState *a, const struct drawState *b)
+{
+	return !(b->reg & ~a->reg)
+		&& !(b->geo & ~a->geo)
+		&& !(b->om[0] & ~a->om[0])
+		&& !(b->om[1] & ~a->om[1])
+	;
+}
+
+/* runs of a stretch that don't set everything the others do would
+ * inherit something else once reordered, so they stay where they are;
+ * those left all set the same state
+ */
+static void drawOrder_barriers(const struct drawState *set, int num, bool *isBarrier)
+{
+	bool isChanged = true;
+	
+	memset(isBarrier, 0, num * sizeof(*isBarrier));
+	while (isChanged)
+	{
+		struct drawState all = {0};
+		
+		isChanged = false;
+		for (int i = 0; i < num; ++i)
+		{
+			if (isBarrier[i])
+				continue;
+			all.reg |= set[i].reg;
+			all.geo |= set[i].geo;
+			all.om[0] |= set[i].om[0];
+			all.om[1] |= set[i].om[1];
+		}
+		
+		for (int i = 0; i < num; ++i)
+			if (!isBarrier[i] && !drawState_covers(&set[i], &all))
+				isBarrier[i] = isChanged = true;
+	}
+}
+
+/* orders a group's material runs for fewer texture, palette and
+ * combiner changes; priorities stay in order, and translucent and
+ * decal runs, whose order shows, stay where they are, as do empties
+ * and runs that rely on state set by the run before them
+ */
+static void *drawOrder_group(struct objex_g *g)
+{
+	struct objexUdata *udata = g->objex->udata;
+	struct objex_f *end = g->f + g->fNum;
+	struct drawRun *run;
+	struct drawState *set = 0;
+	bool *isBarrier = 0;
+	struct objex_material *prev = 0;
+	bool isReordered = false;
+	int num = 0;
+	
+	/* noMtl groups don't flush on material changes, and physics
+	 * bodies are ordered by bone
+	 */
+	if (g->noMtl
+		|| !g->fNum
+		|| (g->bone && g->bone->skeleton->isPbody && g->hasSplit)
+	)
+		return success;
+	
+	if (!(run = malloc(g->fNum * sizeof(*run))))
+		return errmsg(ERR_NOMEM);
+	
+	for (struct objex_f *f = g->f; f < end; ++num)
+	{
+		run[num].f = f;
+		run[num].mtl = f->mtl;
+		while (++f < end && f->mtl == run[num].mtl)
+			;
+		run[num].num = f - run[num].f;
+	}
+	
+	if (!(set = malloc(num * sizeof(*set)))
+		|| !(isBarrier = malloc(num * sizeof(*isBarrier)))
+	)
+	{
+		free(set);
+		free(run);
+		return errmsg(ERR_NOMEM);
+	}
+	for (int i = 0; i < num; ++i)
+		drawState_of(run[i].mtl, set + i);
+	
+	bool isFixed(struct objex_material *mtl)
+	{
+		return !mtl
+			|| mtl->isEmpty
+			|| mtl_isBlended(mtl)
+			|| (mtl->gbi && strstr(mtl->gbi, "ZMODE_DEC"))
+		;
+	}
+	
+	for (int i = 0; i < num; )
+	{
+		int n;
+		
+		if (isFixed(run[i].mtl))
+		{
+			/* empties may branch anywhere */
+			prev = (run[i].mtl && !run[i].mtl->isEmpty) ? run[i].mtl : 0;
+			++i;
+			continue;
+		}
+		
+		for (n = 1
+			; i + n < num
+				&& !isFixed(run[i + n].mtl)
+				&& run[i + n].mtl->priority == run[i].mtl->priority
+			; ++n
+		)
+			;
+		
+		drawOrder_barriers(set + i, n, isBarrier + i);
+		for (int k = i; k < i + n; )
+		{
+			int m;
+			
+			if (isBarrier[k])
+			{
+				prev = run[k].mtl;
+				++k;
+				continue;
+			}
+			
+			for (m = 1; k + m < i + n && !isBarrier[k + m]; ++m)
+				;
+			
+			/* the run after sees what the last one set, unless it
+			 * sets all of that itself; if not, the last stays last
+			 */
+			if (k + m < num && !drawState_covers(&set[k + m], &set[k]))
+				--m;
+			
+			if (m && !drawOrder_stretch(udata, run + k, m, prev, &isReordered))
+			{
+				free(isBarrier);
+				free(set);
+				free(run);
+				return 0;
+			}
+			k += m;
+			
+			/* the one kept last */
+			if (k < i + n && !isBarrier[k])
+				++k;
+			prev = run[k - 1].mtl;
+		}
+		i += n;
+	}
+	
+	udata->drawOrder.groups += isReordered;
+	free(isBarrier);
+	free(set);
+	free(run);
+	return success;
+}
+
+/* whether two compiled vertices load identically, regardless of
+ * where they were sorted within the batches they were loaded in
+ */
+static bool compvert_equals(const struct compvert *a, const struct compvert *b)
+{
+	union cvBfV bfA = a->bf;
+	union cvBfV bfB = b->bf;
+	
+	bfA.bf.useCurmatrix = 0;
+	bfB.bf.useCurmatrix = 0;
+	
+	return a->x == b->x
+		&& a->y == b->y
+		&& a->z == b->z
+		&& a->s == b->s
+		&& a->t == b->t
+		&& a->rgba == b->rgba
+		&& a->bone == b->bone
+		&& bfA.v == bfB.v
+	;
+}
+
+#define VTXPOOL_HASH (1 << 14)
+
+/* a compiled vertex as the 16 bytes written to the file */
+static void compvert_record(const struct compvert *cv, uint8_t rec[16])
+{
+	const int16_t h[] = { cv->x, cv->y, cv->z, 0, cv->s, cv->t };
+	
+	for (int i = 0; i < 6; ++i)
+	{
+		rec[i * 2 + 0] = (uint16_t)h[i] >> 8;
+		rec[i * 2 + 1] = h[i];
+	}
+	rec[12] = cv->rgba >> 24;
+	rec[13] = cv->rgba >> 16;
+	rec[14] = cv->rgba >> 8;
+	rec[15] = cv->rgba;
+}
+
+static unsigned vtxPool_hash(const uint8_t rec[16])
+{
+	uint32_t h = 2166136261u; /* fnv-1a */
+	
+	for (int i = 0; i < 16; ++i)
+		h = (h ^ rec[i]) * 16777619u;
+	
+	return h & (VTXPOOL_HASH - 1);
+}
+
+/* how many records starting at `at` were written back to back and
+ * match `rec`, up to `num`
+ */
+static int vtxPool_runLen(struct vtxPool *pool, int at, uint8_t (*rec)[16], int num)
+{
+	int i;
+	
+	for (i = 0; i < num && at + i < pool->num; ++i)
+	{
+		if (pool->ofs[at + i] != pool->ofs[at] + i * 16
+			|| memcmp(pool->rec[at + i], rec[i], 16)
+		)
+			break;
+	}
+	
+	return i;
+}
+
+/* writes records to the end of the file and remembers them */
+static void *vtxPool_write(VFILE *bin, struct vtxPool *pool, uint8_t (*rec)[16], int num)
+{
+	uint32_t ofs = vftell(bin);
+	
+	if (pool->num + num > pool->max)
+	{
+		int max = (pool->max + num) * 2;
+		void *r = realloc(pool->rec, max * sizeof(*pool->rec));
+		void *o = r ? realloc(pool->ofs, max * sizeof(*pool->ofs)) : 0;
+		void *n = o ? realloc(pool->next, max * sizeof(*pool->next)) : 0;
+		
+		if (r) pool->rec = r;
+		if (o) pool->ofs = o;
+		if (n) pool->next = n;
+		if (!n)
+			return errmsg(ERR_NOMEM);
+		pool->max = max;
+	}
+	
+	for (int i = 0; i < num; ++i)
+	{
+		int k = pool->num++;
+		unsigned hash = vtxPool_hash(rec[i]);
+		
+		memcpy(pool->rec[k], rec[i], 16);
+		pool->ofs[k] = ofs + i * 16;
+		pool->next[k] = pool->head[hash];
+		pool->head[hash] = k;
+		
+		vfwrite(rec[i], 1, 16, bin);
+	}
+	pool->bytesWritten += num * 16;
+	
+	return success;
+}
+
+/* splits a load of `num` vertices into pieces that can each be loaded
+ * from one place: runs of two or more the file already contains back
+ * to back (or the whole load) are shared, and the rest gets written
+ */
+static void *vtxPool_put(
+	VFILE *bin
+	, struct objexUdata *udata
+	, const struct compvert *cv
+	, int num
+	, struct vtxLoad *load
+	, int *loadNum
+)
+{
+	struct vtxPool *pool = udata->vtxPool;
+	uint8_t rec[UCODE_VBUF_CAP][16];
+	int pending = 0; /* records not found, to be written together */
+	
+	assert(num <= UCODE_VBUF_CAP);
+	
+	if (!pool)
+	{
+		if (!(pool = udata->vtxPool = calloc(1, sizeof(*pool)))
+			|| !(pool->head = malloc(VTXPOOL_HASH * sizeof(*pool->head)))
+		)
+			return errmsg(ERR_NOMEM);
+		for (int i = 0; i < VTXPOOL_HASH; ++i)
+			pool->head[i] = -1;
+	}
+	
+	for (int i = 0; i < num; ++i)
+		compvert_record(cv + i, rec[i]);
+	
+	*loadNum = 0;
+	for (int i = 0; i <= num; )
+	{
+		int best = 0;
+		int bestAt = -1;
+		
+		/* longest run already in the file starting with this record */
+		if (i < num)
+		{
+			for (int at = pool->head[vtxPool_hash(rec[i])]; at >= 0; at = pool->next[at])
+			{
+				int len = vtxPool_runLen(pool, at, rec + i, num - i);
+				if (len > best)
+				{
+					best = len;
+					bestAt = at;
+				}
+			}
+			if (best < 2 && best < num)
+				best = 0;
+		}
+		
+		/* write what wasn't found before moving past it */
+		if (pending && (best || i == num))
+		{
+			load[*loadNum].ofs = vftell(bin);
+			load[*loadNum].num = pending;
+			*loadNum += 1;
+			if (!vtxPool_write(bin, pool, rec + i - pending, pending))
+				return 0;
+			pending = 0;
+		}
+		
+		if (i == num)
+			break;
+		
+		if (!best)
+		{
+			++pending;
+			++i;
+			continue;
+		}
+		
+		load[*loadNum].ofs = pool->ofs[bestAt];
+		load[*loadNum].num = best;
+		*loadNum += 1;
+		pool->bytesShared += best * 16;
+		i += best;
+	}
+	pool->extraLoads += *loadNum - 1;
+	
+	return success;
+}
+
+/* forgets the records written at or past `ofs` (--pool-vertices) */
+static void vtxPool_truncate(struct vtxPool *pool, uint32_t ofs)
+{
+	while (pool && pool->num && pool->ofs[pool->num - 1] >= ofs)
+	{
+		int k = --pool->num;
+		
+		/* newest first, so each is the head of its chain */
+		pool->head[vtxPool_hash(pool->rec[k])] = pool->next[k];
+		pool->bytesWritten -= 16;
+	}
+}
+
+/* --pool-dlists: how many bytes a command loads from the address in
+ * its second word, if it is one into the file, so commands can be
+ * compared by what they load rather than where from
+ */
+static int dlPool_loads(uint8_t *cmd, uint32_t baseOfs, uint32_t fileEnd)
+{
+	uint32_t lo = get32(cmd + 4);
+	int bytes = 0;
+	
+	switch (get8(cmd))
+	{
+		case G_VTX:
+			bytes = ((get32(cmd) >> 12) & 0xFF) * 16;
+			break;
+		
+		case G_MTX:
+			bytes = 64;
+			break;
+	}
+	
+	if (lo - baseOfs > fileEnd || lo - baseOfs + bytes > fileEnd)
+		return 0;
+	
+	return bytes;
+}
+
+static unsigned dlPool_hash(uint8_t *data, const struct dlPoolBlock *b, uint32_t baseOfs)
+{
+	uint32_t h = 2166136261u; /* fnv-1a */
+	
+	void add(uint8_t *p, int bytes)
+	{
+		for (int i = 0; i < bytes; ++i)
+			h = (h ^ p[i]) * 16777619u;
+	}
+	
+	add(data + b->dl, b->cmd - b->dl);
+	for (uint32_t i = b->cmd; i + 8 <= b->end; i += 8)
+	{
+		int bytes = dlPool_loads(data + i, baseOfs, b->end);
+		
+		add(data + i, 4);
+		if (bytes)
+			add(data + get32(data + i + 4) - baseOfs, bytes);
+		else
+			add(data + i + 4, 4);
+	}
+	
+	return h;
+}
+
+/* whether display list `b` draws what `a` does */
+static bool dlPool_same(uint8_t *data, const struct dlPoolBlock *a, const struct dlPoolBlock *b, uint32_t baseOfs)
+{
+	if (a->hash != b->hash
+		|| a->cmd - a->dl != b->cmd - b->dl
+		|| a->end - a->cmd != b->end - b->cmd
+		|| memcmp(data + a->dl, data + b->dl, a->cmd - a->dl)
+	)
+		return false;
+	
+	for (uint32_t i = 0; b->cmd + i + 8 <= b->end; i += 8)
+	{
+		uint8_t *ca = data + a->cmd + i;
+		uint8_t *cb = data + b->cmd + i;
+		int bytes = dlPool_loads(cb, baseOfs, b->end);
+		
+		if (get32(ca) != get32(cb))
+			return false;
+		
+		/* same address, or the same data somewhere else */
+		if (get32(ca + 4) != get32(cb + 4)
+			&& (!bytes
+				|| dlPool_loads(ca, baseOfs, b->end) != bytes
+				|| memcmp(
+					data + get32(ca + 4) - baseOfs
+					, data + get32(cb + 4) - baseOfs
+					, bytes
+				)
+			)
+		)
+			return false;
+	}
+	
+	return true;
+}
+
+/* a group's display list was just written: its vertex data starting
+ * at `start`, the list itself at `dl` (commands from `cmd`); if the
+ * file already contains the same block, this one is dropped and the
+ * group uses that one instead
+ */
+static void *dlPool_put(VFILE *bin, struct objex_g *g, size_t start, size_t dl, size_t cmd)
+{
+	struct objex *objex = g->objex;
+	struct objexUdata *udata = objex->udata;
+	struct groupUdata *gUdata = g->udata;
+	struct dlPool *pool = udata->dlPool;
+	uint32_t baseOfs = udata->baseOfs;
+	struct dlPoolBlock b = {
+		.start = start
+		, .dl = dl
+		, .cmd = cmd
+		, .end = vftell(bin)
+	};
+	
+	if (!pool && !(pool = udata->dlPool = calloc(1, sizeof(*pool))))
+		return errmsg(ERR_NOMEM);
+	
+	b.hash = dlPool_hash(bin->data, &b, baseOfs);
+	
+	for (int i = 0; i < pool->num; ++i)
+	{
+		struct dlPoolBlock *a = &pool->block[i];
+		
+		if (!dlPool_same(bin->data, a, &b, baseOfs))
+			continue;
+		
+		/* a material written here for the first time stays */
+		for (struct objex_material *m = objex->mtl; m; m = m->next)
+			if (m->hasWritten && m->useMtlOfs >= b.start && m->useMtlOfs < b.end)
+				goto L_keep;
+		
+		gUdata->dlistOffset = a->dl;
+		document_move(b.cmd + baseOfs, a->cmd + baseOfs, T_DL);
+		dlist_unreloc(objex, b.start, b.end);
+		vtxPool_truncate(udata->vtxPool, b.start);
+		pool->shared += 1;
+		pool->bytesShared += b.end - b.start;
+		
+		vfseek(bin, b.start, SEEK_SET);
+		vftruncate(bin);
+		return success;
+	}
+	
+L_keep:
+	if (pool->num == pool->max)
+	{
+		int max = (pool->max + 8) * 2;
+		void *block = realloc(pool->block, max * sizeof(*pool->block));
+		
+		if (!block)
+			return errmsg(ERR_NOMEM);
+		pool->block = block;
+		pool->max = max;
+	}
+	pool->block[pool->num++] = b;
+	
+	return success;
+}
+
+void zobj_printDlistStats(FILE *docs, struct objex *objex)
+{
+	extern int autoStandalone;
+	extern int orderMaterials;
+	extern int batchLimbs;
+	extern int deltaMaterials;
+	extern int peephole;
+	extern int flattenBranches;
+	struct objexUdata *udata = objex ? objex->udata : 0;
+	struct vtxPool *pool = udata ? udata->vtxPool : 0;
+	struct dlPool *dlPool = udata ? udata->dlPool : 0;
+	
+	if (!docs || !udata)
+		return;
+	
+	if (pool)
+		fprintf(docs
+			, "/* vertex pool: %u of %u vertex bytes shared, %u written"
+			  ", %d more gSPVertex */\n"
+			, pool->bytesShared
+			, pool->bytesWritten + pool->bytesShared
+			, pool->bytesWritten
+			, pool->extraLoads
+		);
+	
+	if (dlPool)
+		fprintf(docs
+			, "/* display list pool: %d of %d display lists shared"
+			  ", %u bytes not written */\n"
+			, dlPool->shared
+			, dlPool->shared + dlPool->num
+			, dlPool->bytesShared
+		);
+	
+	if (autoStandalone)
+		fprintf(docs
+			, "/* standalone materials: %d called, %d inlined"
+			  ", %d bytes saved (estimated) */\n"
+			, udata->standalone.called
+			, udata->standalone.inlined
+			, udata->standalone.bytesSaved
+		);
+	
+	if (orderMaterials)
+		fprintf(docs
+			, "/* material order: %d groups reordered, %u -> %u estimated"
+			  " rdp cycles switching materials */\n"
+			, udata->drawOrder.groups
+			, udata->drawOrder.before
+			, udata->drawOrder.after
+		);
+	
+	if (batchLimbs)
+		fprintf(docs
+			, "/* limb batching: %d groups reordered, %d matrix loads"
+			  " written */\n"
+			, udata->limbs.groups
+			, udata->limbs.matrices
+		);
+	
+	if (deltaMaterials)
+		fprintf(docs
+			, "/* delta materials: %d of %d material calls dropped, %d inlined"
+			  ", %d material commands skipped, %d inline material commands"
+			  " dropped */\n"
+			, udata->delta.omitted
+			, udata->delta.calls
+			, udata->delta.inlined
+			, udata->delta.skipped
+			, udata->delta.dropped
+		);
+	
+	if (flattenBranches)
+		fprintf(docs
+			, "/* branch flattening: %d calls and branches shortened, %d tail"
+			  " calls, display lists nest %d deep of %d */\n"
+			, udata->branches.resolved
+			, udata->branches.tailCalls
+			, udata->branches.deepest
+			, udata->branches.stackMax
+		);
+	
+	if (peephole)
+		fprintf(docs
+			, "/* peephole: %d display list commands removed (%d bytes)"
+			  ", %d of them material calls, %d geometry modes merged */\n"
+			, udata->peephole.removed + udata->peephole.merged
+			, (udata->peephole.removed + udata->peephole.merged) * 8
+			, udata->peephole.calls
+			, udata->peephole.merged
+		);
+}
+
+/* the lines of a material's gbi that affect vertices as they are
+ * loaded (transform, lighting, texture coordinate scale), joined;
+ * returns 0 if that can't be known, like when it calls other lists
+ */
+static char *mtl_vtxState(struct objex_material *mtl)
+{
+	static const char *affects[] = {
+		"Texture(", "GeometryMode", "Light", "Fog", "Matrix", "Viewport", "PerspNorm"
+	};
+	static const char *unknown[] = { "DisplayList", "BranchList", "Vertex" };
+	char *state;
+	char *ln;
+	
+	if (mtl->isEmpty || !(state = calloc(1, strlen(mtl->gbi) + 1)))
+		return 0;
+	
+	for (ln = mtl->gbi; ln && *ln; ln = nextline(ln))
+	{
+		int len = strcspn(ln, "\r\n");
+		char line[len + 1];
+		int i;
+		
+		memcpy(line, ln, len);
+		line[len] = '\0';
+		
+		for (i = 0; i < sizeof(unknown) / sizeof(*unknown); ++i)
+		{
+			if (strstr(line, unknown[i]))
+			{
+				free(state);
+				return 0;
+			}
+		}
+		for (i = 0; i < sizeof(affects) / sizeof(*affects); ++i)
+		{
+			if (strstr(line, affects[i]))
+			{
+				strcat(state, line);
+				break;
+			}
+		}
+	}
+	
+	return state;
+}
+
+/* whether vertices loaded after `prev` are still what loading them
+ * after `next` would give (--resident-vertices): `next` must leave
+ * everything affecting vertex loads alone, or set it as `prev` did
+ */
+static bool mtl_keepsVertices(struct objex_material *prev, struct objex_material *next)
+{
+	char *a;
+	char *b = 0;
+	bool rv;
+	
+	if (!next || !next->gbi)
+		return true;
+	if (!(a = mtl_vtxState(next)))
+		return false;
+	rv = !*a
+		|| (prev
+			&& prev->gbi
+			&& (b = mtl_vtxState(prev))
+			&& !strcmp(a, b)
+		)
+	;
+	
+	free(a);
+	free(b);
+	return rv;
+}
+
+/* the longest triangle strip, of up to `max` triangles, that draws
+ * the first of `num` triangles in order and with the same winding;
+ * writes its vertices to `strip` and returns how many it draws
+ */
+static int tri_strip(const int (*tri)[3], int num, int max, int *strip)
+{
+	int best = 0;
+	
+	/* it can begin on any edge of the first triangle */
+	for (int r = 0; r < 3; ++r)
+	{
+		int s[max + 2];
+		int n;
+		
+		s[0] = tri[0][r];
+		s[1] = tri[0][(r + 1) % 3];
+		s[2] = tri[0][(r + 2) % 3];
+		
+		/* each next triangle starts on the previous one's newest
+		 * edge, reversed every other triangle to keep the winding
+		 */
+		for (n = 1; n < num && n < max; ++n)
 		{
-			free(dup);
-			return errmsg("%s", gfxasm_error());
+			int a = (n & 1) ? s[n + 1] : s[n];
+			int b = (n & 1) ? s[n] : s[n + 1];
+			int k;
+			
+			for (k = 0; k < 3; ++k)
+				if (tri[n][k] == a && tri[n][(k + 1) % 3] == b)
+					break;
+			if (k == 3)
+				break;
+			s[n + 2] = tri[n][(k + 2) % 3];
+		}
+		
+		if (n > best)
+		{
+			best = n;
+			memcpy(strip, s, (n + 2) * sizeof(*s));
 		}
 	}
-	free(dup);
 	
-	/* standalone must end in DF command */
-	if (mtl->isStandalone)
-		vfput64s(bin, 0xDF000000, 0x00000000);
+	return best;
+}
+
+/* drops the commands from `start` to the end of the file that change
+ * nothing, and folds consecutive geometry mode changes together; the
+ * display list must be the last thing written
+ */
+static void *dlist_peephole(VFILE *bin, struct objex *objex, size_t start)
+{
+	struct objexUdata *udata = objex->udata;
+	uint8_t *data = bin->data;
+	size_t end = vftell(bin);
+	size_t out = start;
+	int num = (end - start) / 8;
+	size_t *newOfs;
+	struct dlState st;
+	
+	if (!(newOfs = malloc(num * sizeof(*newOfs))))
+		return errmsg(ERR_NOMEM);
+	
+	dlState_forget(&st);
+	for (int i = 0; i < num; ++i)
+	{
+		size_t at = start + i * 8;
+		uint32_t hi = get32(data + at);
+		uint32_t lo = get32(data + at + 4);
+		bool isBranch = (hi >> 24) == G_DL && (hi & 0x00FF0000);
+		
+		newOfs[i] = out;
+		
+		/* keep branches, since what follows them would run instead */
+		if (dlState_step(&st, data, start, udata->baseOfs, hi, lo, 0)
+			&& !isBranch
+		)
+		{
+			udata->peephole.removed += 1;
+			udata->peephole.calls += (hi >> 24) == G_DL;
+			continue;
+		}
+		
+		/* fold into the geometry mode change just before */
+		if ((hi >> 24) == G_GEOMETRYMODE
+			&& out > start
+			&& (get32(data + out - 8) >> 24) == G_GEOMETRYMODE
+		)
+		{
+			uint32_t clear0 = ~get32(data + out - 8) & 0xFFFFFF;
+			uint32_t set0 = get32(data + out - 4);
+			uint32_t clear1 = ~hi & 0xFFFFFF;
+			
+			put32(data + out - 8, (G_GEOMETRYMODE << 24) | (~(clear0 | clear1) & 0xFFFFFF));
+			put32(data + out - 4, (set0 & ~clear1) | lo);
+			newOfs[i] = out - 8;
+			udata->peephole.merged += 1;
+			continue;
+		}
+		
+		memmove(data + out, data + at, 8);
+		out += 8;
+	}
+	
+	if (out == end)
+	{
+		free(newOfs);
+		return success;
+	}
+	
+	/* relocations written into this display list moved with it */
+	dlist_remap(objex, start, end, newOfs);
+	
+	vfseek(bin, out, SEEK_SET);
+	vftruncate(bin);
+	free(newOfs);
 	
 	return success;
 }
 
+/* a display list as planned before anything is written: the batches
+ * of vertices loaded, the vertex buffer slots each triangle's corners
+ * end up in, and the materials in between; pass 1 writes the vertex
+ * data from this and pass 2 the commands
+ */
+struct dlBatch
+{
+	struct compvert *vbuf; /* vertices loaded, in order */
+	int *slotOf;           /* vertex buffer slot each goes into */
+	int vNum;
+	int (*tri)[3];         /* slots of every triangle's corners */
+	int triNum;
+	struct compvert *slot; /* buffer after loading (--resident-vertices) */
+	size_t vbufOfs;        /* where pass 1 writes vbuf, from its start */
+};
+
+struct dlOp
+{
+	bool isMaterial;
+	struct objex_material *mtl; /* material to use, if isMaterial */
+	struct objex_bone *bone;    /* bone of the group it starts */
+	bool keepsVertices;         /* leaves the vertex buffer intact */
+	struct dlBatch batch;       /* otherwise, geometry to draw */
+};
+
+struct dlPlan
+{
+	struct dlOp *op;
+	int num;
+	int max;
+};
+
+static struct dlOp *dlPlan_push(struct dlPlan *plan)
+{
+	if (plan->num == plan->max)
+	{
+		int max = (plan->max + 8) * 2;
+		struct dlOp *op = realloc(plan->op, max * sizeof(*op));
+		
+		if (!op)
+			return errmsg(ERR_NOMEM);
+		plan->op = op;
+		plan->max = max;
+	}
+	
+	memset(plan->op + plan->num, 0, sizeof(*plan->op));
+	return plan->op + plan->num++;
+}
+
+static void dlPlan_free(struct dlPlan *plan)
+{
+	for (int i = 0; i < plan->num; ++i)
+	{
+		struct dlBatch *b = &plan->op[i].batch;
+		
+		free(b->vbuf);
+		free(b->slotOf);
+		free(b->tri);
+		free(b->slot);
+	}
+	free(plan->op);
+	memset(plan, 0, sizeof(*plan));
+}
+
+/* how many vertices from b->vbuf[i] one gSPVertex loads: they must
+ * go into consecutive slots and share a state
+ */
+static int dlBatch_loadLen(const struct dlBatch *b, int i)
+{
+	int n;
+	
+	for (n = 1; i + n < b->vNum; ++n)
+		if (b->slotOf[i + n] != b->slotOf[i] + n
+			|| b->vbuf[i + n].bf.v != b->vbuf[i].bf.v
+		)
+			break;
+	
+	return n;
+}
+
 void *zobj_writeDlist(
 	VFILE *bin
 	, struct objex_g *g
@@ -1362,11 +4095,19 @@ void *zobj_writeDlist(
 		return success;
 	}
 	
+	extern int reorderTriangles;
+	extern int orderMaterials;
+	extern int residentVertices;
+	extern int poolVertices;
+	extern int batchLimbs;
+	extern int peephole;
+	extern int poolDlists;
 	FILE *docs = 0;
 	struct groupUdata *gUdata;
 	int matrixBone = -1;
 	size_t vbufStart = 0;
-	struct compvert vbuf[VBUF_MAX];
+	size_t dlStart = 0; /* first command, past any POSMTX matrix */
+	struct compvert vbuf[UCODE_VBUF_CAP];
 	struct objex *objex = g->objex;
 	struct objex_v *v = objex->v;
 	struct objex_vt *vt = objex->vt;
@@ -1415,10 +4156,15 @@ void *zobj_writeDlist(
 	}
 //	fprintf(stderr, "%s: matrixBone = %d\n", g->name, matrixBone);
 	
+	#define vbuf_push(N)            \
+	(                               \
+		isResident                   \
+		? residentPush(N)            \
+		: compbuf_push(vbuf, &vtotal, gUcode->vbufMax, N) \
+	)
 	#define compbuf_compile()       \
-	x = compbuf_push(vbuf, &vtotal  \
-		, VBUF_MAX                   \
-		, compbuf_new(               \
+	x = vbuf_push(                  \
+		compbuf_new(                 \
 			g                         \
 			, &v[f->v.x]              \
 			, &vt[f->vt.x]            \
@@ -1428,9 +4174,8 @@ void *zobj_writeDlist(
 			, f->mtl                  \
 		)                            \
 	); (void)x;                     \
-	y = compbuf_push(vbuf, &vtotal  \
-		, VBUF_MAX                   \
-		, compbuf_new(               \
+	y = vbuf_push(                  \
+		compbuf_new(                 \
 			g                         \
 			, &v[f->v.y]              \
 			, &vt[f->vt.y]            \
@@ -1440,9 +4185,8 @@ void *zobj_writeDlist(
 			, f->mtl                  \
 		)                            \
 	); (void)y;                     \
-	z = compbuf_push(vbuf, &vtotal  \
-		, VBUF_MAX                   \
-		, compbuf_new(               \
+	z = vbuf_push(                  \
+		compbuf_new(                 \
 			g                         \
 			, &v[f->v.z]              \
 			, &vt[f->vt.z]            \
@@ -1456,51 +4200,352 @@ void *zobj_writeDlist(
 	/* sort triangles by material priority */
 	objex_g_sortByMaterialPriority(g);
 	
-	/* two passes:
-	 * pass 1: write vertex buffers
-	 * pass 2: write display list
+	/* order materials within each priority, only once */
+	if (orderMaterials && !gUdata->isOrdered)
+	{
+		gUdata->isOrdered = 1;
+		if (!drawOrder_group(g))
+			return 0;
+	}
+	
+	/* then reorder them within each material, only once */
+	if (reorderTriangles && !gUdata->isReordered)
+	{
+		gUdata->isReordered = 1;
+		if (!vcache_reorder(g, docs))
+			return 0;
+	}
+	
+	/* and group them by limb, keeping the order within each */
+	if (batchLimbs && !gUdata->isLimbOrdered)
+	{
+		gUdata->isLimbOrdered = 1;
+		if (g->bone && !(g->bone->skeleton->isPbody && g->hasSplit)
+			&& !limbOrder_group(g)
+		)
+			return 0;
+	}
+	
+	/* the group is planned once (see struct dlOp), then pass 1 writes
+	 * its vertex data and pass 2 its display list from that
 	 */
-
-	for (int pass = passStart; pass <= passEnd; ++pass)
+	struct dlPlan plan = { 0 };
+	struct objex_f *fStart = g->f;
+	size_t vbufRel = 0; /* vertex data planned so far */
+	int isPbody = 0; /* is physics body */
+	bool isResident = false;
+	/* --resident-vertices: what the vertex buffer holds (`live`), and
+	 * which of that the batch being gathered uses (`pinned`)
+	 */
+	struct compvert slot[UCODE_VBUF_CAP];
+	uint64_t live = 0;
+	uint64_t pinned = 0;
+	int batchLimb; /* matrix loaded when a batch starts (--batch-limbs) */
+	
+	/* is physics body */
+	if (g->bone
+		&& g->bone->skeleton->isPbody
+		&& g->hasSplit /* hasSplit is necessary; if (!hasSplit),
+						* handle as any other mesh assigned to
+						* a single bone would be */
+	)
+		isPbody = 1;
+	
+	/* for physics bodies, force writing matrix at start
+	 * of display list regardless
+	 */
+	if (isPbody)
+		matrixBone = -1;
+	
+	/* physics bodies reload matrices as they go, so they don't */
+	isResident = residentVertices && !isPbody;
+	batchLimb = matrixBone;
+	
+	/* finds a vertex among those still in the buffer, otherwise
+	 * adds it to the batch (--resident-vertices)
+	 */
+	int residentPush(struct compvert n)
 	{
-		Gfx gfxLast = {0};
-		vtotal = 0;
-		struct objex_f *fStart = g->f;
-		size_t vbufCur = 0;
-		vtotal = 0;
-		int prevLimb = matrixBone;
-		int prevPbody = -1;
-		int isPbody = 0; /* is physics body */
-		struct cvBf Obf = { 0 };
-		int firstV = 0;
+		for (int i = 0; i < gUcode->vbufMax; ++i)
+		{
+			if (!((live >> i) & 1) || !compvert_equals(&slot[i], &n))
+				continue;
+			
+			pinned |= 1ull << i;
+			return i;
+		}
 		
-		/* is physics body */
-		if (g->bone
-			&& g->bone->skeleton->isPbody
-			&& g->hasSplit /* hasSplit is necessary; if (!hasSplit),
-							* handle as any other mesh assigned to
-							* a single bone would be */
+		return compbuf_push(vbuf, &vtotal, gUcode->vbufMax, n);
+	}
+	
+	/* orders the vertices gathered for a batch */
+	void sortBatch(void)
+	{
+		/* we want vertices using matrixBone to be first, so we
+		 * don't have to write a DA command for them; or, with
+		 * --batch-limbs, whichever matrix the last batch left
+		 */
+		int first = batchLimbs ? batchLimb : matrixBone;
+		
+		for (int i = 0; i < vtotal; ++i)
+		{
+			struct cvBf *bf = &vbuf[i].bf.bf;
+			if ((bf->useMatrix && bf->matrixId == first)
+				|| isPbody  /* XXX fixes hilda dress (costs extra da commands) */
+			)
+				bf->useCurmatrix = 1;
+		}
+		
+		/* sort vertices by subgroup */
+		if (poolVertices)
+			ks_mergesort(compvertPool, vtotal, vbuf, 0);
+		else
+			ks_mergesort(compvert, vtotal, vbuf, 0);
+	}
+	
+	/* plans the batch gathered since the last flush */
+	void *binflush(void)
+	{
+		struct dlOp *op;
+		struct dlBatch *b;
+		int next = 0;
+		
+		/* when dealing with triangles that are empties,
+		 * we write no geometry here */
+		if (isEmpty)
+			goto L_jump2clear;
+		
+		sortBatch();
+		
+		/* the matrix state_change leaves loaded */
+		if (g->bone && !isPbody)
+			batchLimb = vbuf[vtotal - 1].bf.bf.matrixId;
+		
+		if (!(op = dlPlan_push(&plan)))
+			return 0;
+		b = &op->batch;
+		b->vNum = vtotal;
+		b->triNum = f - fStart;
+		b->vbufOfs = vbufRel;
+		if (!(b->vbuf = malloc(vtotal * sizeof(*b->vbuf)))
+			|| !(b->slotOf = malloc(vtotal * sizeof(*b->slotOf)))
+			|| !(b->tri = malloc(b->triNum * sizeof(*b->tri)))
 		)
-			isPbody = 1;
+			return errmsg(ERR_NOMEM);
+		memcpy(b->vbuf, vbuf, vtotal * sizeof(*b->vbuf));
 		
-		/* for physics bodies, force writing matrix at start
-		 * of display list regardless
+		/* resident vertices go into the lowest slots nothing in
+		 * this batch uses, others one after another
 		 */
-		if (isPbody)
-			matrixBone = -1;
+		for (int i = 0; i < vtotal; ++i)
+		{
+			while (isResident && ((pinned >> next) & 1))
+				++next;
+			b->slotOf[i] = next++;
+		}
+		
+		if (isResident)
+		{
+			for (int i = 0; i < vtotal; ++i)
+			{
+				slot[b->slotOf[i]] = vbuf[i];
+				live |= 1ull << b->slotOf[i];
+			}
+			if (!(b->slot = malloc(sizeof(slot))))
+				return errmsg(ERR_NOMEM);
+			memcpy(b->slot, slot, sizeof(slot));
+		}
+		
+		/* vertex buffer slot of every corner */
+		for (struct objex_f *fEnd = (f = fStart, fStart + b->triNum); f < fEnd; ++f)
+		{
+			int x, y, z;
+			compbuf_compile();
+			b->tri[f - fStart][0] = x;
+			b->tri[f - fStart][1] = y;
+			b->tri[f - fStart][2] = z;
+		}
+		
+		/* a corner not in the buffer after all */
+		if (vtotal != b->vNum)
+			return errmsg("group '%s' vertex buffer simulation mismatch", g->name);
 		
+		vbufRel += vtotal * 16;
+		
+		/* always clear these */
+	L_jump2clear:
+		vtotal = 0;
+		pinned = 0;
+		fStart = f;
+		return success;
+	}
+	
+	/* plan one group */
+	void *oneGroup(struct objex_g *g)
+	{
+		/* every face */
+		fStart = g->f;
+		isEmpty = 0;
+		for (f = g->f; f - g->f < g->fNum; ++f)
+		{
+			/* on material change, use zobj's usemtl equivalent */
+			if (!g->noMtl && (f == g->f || f->mtl != f[-1].mtl))
+			{
+				struct dlOp *op;
+				
+				if (f > fStart)
+				{
+					if (!binflush())
+						return 0;
+				}
+				
+				if (!(op = dlPlan_push(&plan)))
+					return 0;
+				op->isMaterial = true;
+				op->mtl = f->mtl;
+				op->bone = g->bone;
+				
+				/* the limb matrix restored before a branch leaves
+				 * the next batch to load its own
+				 */
+				if (f->mtl && f->mtl->isEmpty && batchLimb != matrixBone && g->bone)
+					batchLimb = -1;
+				
+				/* what's loaded may no longer be what it would be */
+				op->keepsVertices = f > g->f && mtl_keepsVertices(f[-1].mtl, f->mtl);
+				if (!op->keepsVertices)
+					live = 0;
+				
+				if (f->mtl && f->mtl->tex0)
+					tex = f->mtl->tex0;
+				else
+					tex = 0;
+				
+				if (f->mtl)
+					isEmpty = f->mtl->isEmpty;
+				else
+					isEmpty = 0;
+				
+//				if (f->mtl)
+//					debugf("'%s' = %d\n", f->mtl->name, f->mtl->isEmpty);
+			}
+			
+			/* push triangle's vertices into vertex buffer */
+			int x, y, z;
+			int Ovtotal = vtotal;
+			uint64_t Opinned = pinned;
+			compbuf_compile();
+			
+			/* vbuf exceeded (resident vertices it uses count too) */
+			if (vtotal + __builtin_popcountll(pinned) > gUcode->vbufMax)
+			{
+				vtotal = Ovtotal;
+				pinned = Opinned;
+				
+				if (!binflush())
+					return 0;
+				
+				/* retry this triangle next iteration */
+				f--;
+			}
+		}
+		if (f > fStart)
+		{
+			if (!binflush())
+				return 0;
+		}
+		return g;
+	} /* oneGroup */
+	
+	/* is a Pbody, so we recombine all skeleton groups */
+	void *oneBone(struct objex_bone *b) {
+		if (b->g && !oneGroup(b->g)) return 0;
+		if (b->child && !oneBone(b->child)) return 0;
+		if (b->next && !oneBone(b->next)) return 0;
+		return b;
+	}
+	
+	/* is not a Pbody, so we can plan it this way */
+	vtotal = 0;
+	if (isPbody ? (g->skeleton && !oneBone(g->skeleton->bone)) : !oneGroup(g))
+	{
+		dlPlan_free(&plan);
+		return 0;
+	}
+	
+	/* pass 1: write vertex buffers */
+	void *writeVertices(void)
+	{
 		/* dlists and vertex buffers must be 8-byte aligned */
 		vfalign(bin, 8);
+		vbufStart = vftell(bin);
+		gUdata->vtxLoadNum = 0;
 		
-		if (pass == 1)
-			vbufStart = vftell(bin);
-		else if (pass == 2)
+		for (struct dlOp *op = plan.op; op < plan.op + plan.num; ++op)
 		{
-			gUdata->dlistOffset = vftell(bin);
-			gUdata->hasWritten = 1;
+			struct dlBatch *b = &op->batch;
+			
+			if (op->isMaterial)
+				continue;
+			
+			if (!poolVertices)
+			{
+				for (int i = 0; i < b->vNum; ++i)
+				{
+					uint8_t rec[16];
+					
+					compvert_record(b->vbuf + i, rec);
+					vfwrite(rec, 1, sizeof(rec), bin);
+				}
+				continue;
+			}
+			
+			/* --pool-vertices: written only where the file doesn't
+			 * already contain them, noting where each piece was
+			 */
+			for (int i = 0, n; i < b->vNum; i += n)
+			{
+				int num = 0;
+				
+				n = dlBatch_loadLen(b, i);
+				if (gUdata->vtxLoadNum + n > gUdata->vtxLoadMax)
+				{
+					int max = (gUdata->vtxLoadMax + n) * 2;
+					void *load = realloc(gUdata->vtxLoad, max * sizeof(*gUdata->vtxLoad));
+					
+					if (!load)
+						return errmsg(ERR_NOMEM);
+					gUdata->vtxLoad = load;
+					gUdata->vtxLoadMax = max;
+				}
+				
+				if (!vtxPool_put(bin, objexUdata, b->vbuf + i, n
+					, gUdata->vtxLoad + gUdata->vtxLoadNum, &num)
+				)
+					return 0;
+				gUdata->vtxLoadNum += num;
+			}
 		}
-		vbufCur = vbufStart + baseOfs;
-						
+		
+		return success;
+	}
+	
+	/* pass 2: write display list */
+	void *writeCommands(void)
+	{
+		Gfx gfxLast = {0};
+		int prevLimb = matrixBone;
+		int prevPbody = -1;
+		struct cvBf Obf = { 0 };
+		int firstV = 0;
+		/* what the vertex buffer holds going only by the commands
+		 * written (--resident-vertices)
+		 */
+		struct compvert sim[UCODE_VBUF_CAP];
+		uint64_t simLive = 0;
+		int vtxLoadCur = 0; /* --pool-vertices: next in gUdata->vtxLoad */
+		unsigned int posMtxAddr = 0;
+		
 		/* change state: use Ov's state */
 		/* TODO ugly nested function */
 		void *state_change(struct compvert *Ov)
@@ -1577,8 +4622,7 @@ void *zobj_writeDlist(
 							limb = bUdat->matrixIndex;
 							mtxaddr = b->skeleton->segment;
 							mtxaddr += 0x40 * limb;
-							gfx.hi = 0xDA380003;
-							gfx.lo = mtxaddr;
+							gfx = gUcode->matrix(mtxaddr, true);
 						
 							/* write local identity matrices */
 							//if (!localMatrix(bin, b->skeleton, mtxaddr, limb))
@@ -1591,6 +4635,7 @@ void *zobj_writeDlist(
 								vfput32(bin, gfx.hi);
 								vfput32(bin, gfx.lo);
 								gfxLast = gfx;
+								objexUdata->limbs.matrices += 1;
 							}
 							prevLimb = limb;
 						}
@@ -1605,13 +4650,10 @@ void *zobj_writeDlist(
 							limb = bf.matrixId;
 							mtxaddr = g->bone->skeleton->segment;
 							mtxaddr += 0x40 * limb;
-							/* matrix relative to parent (apply) */
-							if (b)
-								gfx.hi = 0xDA380001;
-							/* no parent, so we load instead */
-							else
-								gfx.hi = 0xDA380003;
-							gfx.lo = mtxaddr;
+							/* matrix relative to parent (apply);
+							 * no parent, so we load instead
+							 */
+							gfx = gUcode->matrix(mtxaddr, !b);
 						
 							/* write local identity matrices */
 							//if (!localMatrix(bin, g->bone->skeleton, mtxaddr, limb))
@@ -1626,6 +4668,7 @@ void *zobj_writeDlist(
 								vfput32(bin, gfx.hi);
 								vfput32(bin, gfx.lo);
 								gfxLast = gfx;
+								objexUdata->limbs.matrices += 1;
 							}
 							prevPbody = bf.usePbody;
 							prevLimb = limb;
@@ -1644,14 +4687,14 @@ void *zobj_writeDlist(
 						mtxaddr += 0x40 * limb;
 						//gSPMatrix(p++, mtxaddr, G_MTX_PUSH | G_MTX_LOAD);
 						
-						gfx.hi = 0xDA380003;
-						gfx.lo = mtxaddr;
+						gfx = gUcode->matrix(mtxaddr, true);
 						// write DA command */
 						if (gfx.hi != gfxLast.hi || gfx.lo != gfxLast.lo)
 						{
 							vfput32(bin, gfx.hi);
 							vfput32(bin, gfx.lo);
 							gfxLast = gfx;
+							objexUdata->limbs.matrices += 1;
 						}
 						
 						/* write local identity matrices */
@@ -1664,312 +4707,245 @@ void *zobj_writeDlist(
 			return success;
 		}
 		
-		/* TODO ugly nested function */
-		void *binflush(void)
-		{
-			/* when dealing with triangles that are empties,
-			 * we write no geometry here */
-			if (isEmpty)
-				goto L_jump2clear;
-			/* we want vertices using matrixBone to be first, so we
-			 * don't have to write a DA command for them
-			 */
-			for (int i = 0; i < vtotal; ++i)
-			{
-				struct cvBf *bf = &vbuf[i].bf.bf;
-				if ((bf->useMatrix && bf->matrixId == matrixBone)
-					|| (bf->usePbody == prevPbody && bf->matrixId == prevLimb)
-					|| (isPbody && !bf->usePbody)
-					|| isPbody  /* XXX fixes hilda dress (costs extra da commands) */
-				)
-					bf->useCurmatrix = 1;
-			}
-			
-			/* sort vertices by subgroup */
-			ks_mergesort(compvert, vtotal, vbuf, 0);
+		/* loads b->vbuf[i] through b->vbuf[i + n - 1]; with
+		 * --pool-vertices, each piece from wherever pass 1 put it
+		 */
+		void *loadRun(struct dlBatch *b, int i, int n)
+		{
+			Gfx gfx;
+			
+			if (!poolVertices)
+			{
+				gfx = gUcode->vertex(
+					vbufStart + baseOfs + b->vbufOfs + i * 16
+					, n
+					, b->slotOf[i]
+				);
+				vfput32(bin, gfx.hi);
+				vfput32(bin, gfx.lo);
+				return success;
+			}
+			
+			for (int k = 0; k < n; )
+			{
+				struct vtxLoad *load = gUdata->vtxLoad + vtxLoadCur++;
+				
+				if (vtxLoadCur > gUdata->vtxLoadNum || k + load->num > n)
+					return errmsg("group '%s' vertex pool mismatch", g->name);
+				
+				gfx = gUcode->vertex(load->ofs + baseOfs, load->num, b->slotOf[i] + k);
+				vfput32(bin, gfx.hi);
+				vfput32(bin, gfx.lo);
+				k += load->num;
+			}
+			
+			return success;
+		}
+		
+		/* writes a batch's triangles */
+		void writeFaces(struct dlBatch *b)
+		{
+			int (*tri)[3] = b->tri;
+			int num = b->triNum;
 			
-			if (pass == 1)
-			{
-				/* write_vbuf */
-				for (int i = 0; i < vtotal; ++i)
-				{
-					vfput16(bin, vbuf[i].x);
-					vfput16(bin, vbuf[i].y);
-					vfput16(bin, vbuf[i].z);
-					vfput16(bin, 0);
-					vfput16(bin, vbuf[i].s);
-					vfput16(bin, vbuf[i].t);
-					vfput32(bin, vbuf[i].rgba);
-				}
-			}
-			else /* pass == 2 */
+			for (int i = 0, n; i < num; i += n)
 			{
 				Gfx gfx;
-				Gfx *p;
-				struct compvert *Ov = vbuf;
-				int vidx = 0;
-				struct compvert *vWalk;
+				int strip[gUcode->stripMax + 2];
 				
-				/* step through vertices one at a time, performing
-				 * material/matrix state changes where necessary
-				 */
-				for (vWalk = vbuf; vWalk - vbuf < vtotal; ++vWalk)
+				n = 0;
+				if (gUcode->stripMax)
+					n = tri_strip(tri + i, num - i, gUcode->stripMax, strip);
+				
+				/* a strip is only worth it for more than two */
+				if (n > 2)
+					gfx = gUcode->strip(strip, n + 2);
+				else if (num - i == 1)
 				{
-					/* subgroup of current vertex doesn't match previous */
-					/* TODO FIXME bone comparison */
-					if (vWalk->bf.v != Ov->bf.v)
-					//if (vWalk->subgroup != Ov->subgroup || vWalk->bone != Ov->bone)
-					{
-						int vnum = vWalk - Ov;
-						
-						/* write Ov's state */
-						if (!state_change(Ov))
-							return 0;
-						
-						/* generate command */
-						p = &gfx;
-						gSPVertex(p++, (vbufCur + vidx * 16), vnum, vidx);
-					
-						/* write command into file */
-						vfput32(bin, gfx.hi);
-						vfput32(bin, gfx.lo);
-						
-						/* advance */
-						vidx += vnum;
-						Ov = vWalk;
-					}
+					/* one triangle */
+					gfx = gUcode->tri1(tri[i][0], tri[i][1], tri[i][2]);
+					n = 1;
 				}
-				/* write last vertex group */
-				if (vWalk > Ov)
+				else
 				{
-					int vnum = vWalk - Ov;
-					
-					/* write Ov's state */
-					if (!state_change(Ov))
-						return 0;
-					
-					p = &gfx;
-					gSPVertex(p++, (vbufCur + vidx * 16), vnum, vidx);
-					
-					/* write commands into file */
-					vfput32(bin, gfx.hi);
-					vfput32(bin, gfx.lo);
+					/* two triangles */
+					gfx = gUcode->tri2(
+						tri[i][0], tri[i][1], tri[i][2]
+						, tri[i + 1][0], tri[i + 1][1], tri[i + 1][2]
+					);
+					n = 2;
 				}
 				
-				/* write_faces */
-				struct objex_f *fEnd = f;
-				for (f = fStart; f < fEnd; ++f)
-				{
-					p = &gfx;
-					
-					if (fEnd - f == 1)
-					{
-						/* one triangle */
-						int x, y, z;
-						compbuf_compile();
-						
-						gSP1Triangle(p++, x, y, z, 0);
-					}
-					else
-					{
-						/* two triangles */
-						int x0, y0, z0;
-						int x, y, z;
-						
-						compbuf_compile();
-						x0 = x;
-						y0 = y;
-						z0 = z;
-						
-						/*if (x == y || y == z || x == z)
-						{
-							fprintf(stderr, "invalid f %d %d %d\n", x, y, z);
-						}*/
-			
-						++f;
-						compbuf_compile();
-						
-						gSP2Triangles(p++, x0, y0, z0, 0, x, y, z, 0);
-					}
-					
-					/* write commands into file */
-					vfput32(bin, gfx.hi);
-					vfput32(bin, gfx.lo);
-				}
+				/* write commands into file */
+				vfput32(bin, gfx.hi);
+				vfput32(bin, gfx.lo);
 			}
-			
-			vbufCur += vtotal * 16;
-			
-			/* always clear these */
-		L_jump2clear:
-			vtotal = 0;
-			fStart = f;
-			return success;
 		}
 		
-		/* write one group */
-		void *oneGroup(struct objex_g *g)
+		/* dlists and vertex buffers must be 8-byte aligned */
+		vfalign(bin, 8);
+		
+		gUdata->dlistOffset = vftell(bin);
+		gUdata->hasWritten = 1;
+		gLoadedAtlas = 0; /* nothing is known to be in TMEM yet */
+		
+		/* has POSMTX attrib */
+		if (g->attrib && strstr(g->attrib, "POSMTX"))
+		{
+			posMtxAddr = vftell(bin) + baseOfs;
+			if (!posMtx(bin, g->origin.x, g->origin.y, g->origin.z))
+				return 0;
+		}
+		
+		dlStart = vftell(bin);
+		
+		/* nothing is known of the state it runs in */
+		dlState_forget(&gDlState);
+		gDlStart = gDlStateOfs = dlStart;
+		gDlStateOn = true;
+		
+		/* print docs */
+		// fprintf(docs, DOCS_DEF "DL_" DOCS_SPACE "   0x%08X\n"
+		// 	, Canitize(g->name, 1)
+		// 	, (int)vftell(bin) + baseOfs
+		// );
+		document_assign(
+			g->name,
+			NULL,
+			(int)vftell(bin) + baseOfs,
+			T_DL
+		);
+		debugf(" > '%s' address %08X\n", g->name, (int)vftell(bin) + baseOfs);
+		
+		/* has attributes */
+		if (g->attrib)
+		{
+			/* world positioning matrix (must precede bbmtx)
+			 * (ex: search 01000040 in Z2_TOWN_room_00.zmap) */
+			if (strstr(g->attrib, "POSMTX"))
+				putMatrix(bin, posMtxAddr, true);
+			/* explicit limb billboard */
+			if (strstr(g->attrib, "LIMBMTX"))
+			{
+				if (matrixBone < 0)
+					return errmsg(
+						"group '%s' incompatible with attrib LIMBMTX;"
+						" is it a Pbody?"
+						, g->name
+					);
+				putMatrix(
+					bin
+					, g->bone->skeleton->segment + 0x40 * matrixBone
+					, true
+				);
+			}
+			/* explicit spherical billboard */
+			if (strstr(g->attrib, "BBMTXS"))
+				putMatrix(bin, 0x01000000, false);
+			/* explicit cylindrical billboard */
+			if (strstr(g->attrib, "BBMTXC"))
+				putMatrix(bin, 0x01000040, false);
+		}
+		
+		for (struct dlOp *op = plan.op; op < plan.op + plan.num; ++op)
 		{
-			/* every face */
-			fStart = g->f;
-			isEmpty = 0;
-			for (f = g->f; f - g->f < g->fNum; ++f)
+			struct dlBatch *b = &op->batch;
+			
+			if (op->isMaterial)
 			{
-				/* on material change, write zobj's usemtl equivalent */
-				if (!g->noMtl && (f == g->f || f->mtl != f[-1].mtl))
-				{
-					if (f > fStart)
-					{
-						if (!binflush())
-							return 0;
-					}
-					
-					if (f->mtl && f->mtl->tex0)
-						tex = f->mtl->tex0;
-					else
-						tex = 0;
-					
-					if (pass == 2)
-					{
-						/* restore limb matrix before branch if needed */
-						if (f->mtl
-							&& f->mtl->isEmpty
-							&& prevLimb != matrixBone
-							&& g->bone
-						)
-						{
-							struct objex_bone *b = g->bone;
-							struct boneUdata *bUdat;
-							Gfx gfx;
-							int limb;
-							unsigned mtxaddr;
-							
-							if (!(bUdat = b->udata))
-								return errmsg("bone '%s' unprocessed", b->name);
-							
-							limb = bUdat->matrixIndex;
-							mtxaddr = b->skeleton->segment;
-							mtxaddr += 0x40 * limb;
-							gfx.hi = 0xDA380003;
-							gfx.lo = mtxaddr;
-							vfput32(bin, gfx.hi);
-							vfput32(bin, gfx.lo);
-							prevLimb = -1; /* just in case stacked DE's */
-						}
-						
-						/* write material (or branch) */
-						if (!zobj_writeUsemtl(bin, f->mtl))
-							return 0;
-					}
-					
-					if (f->mtl)
-						isEmpty = f->mtl->isEmpty;
-					else
-						isEmpty = 0;
-					
-//					if (f->mtl)
-//						debugf("'%s' = %d\n", f->mtl->name, f->mtl->isEmpty);
-				}
-				
-				/* push triangle's vertices into vertex buffer */
-				int x, y, z;
-				int Ovtotal = vtotal;
-				compbuf_compile();
+				if (!op->keepsVertices)
+					simLive = 0;
 				
-				/* vbuf exceeded */
-				if (vtotal > VBUF_MAX)
+				/* restore limb matrix before branch if needed */
+				if (op->mtl
+					&& op->mtl->isEmpty
+					&& prevLimb != matrixBone
+					&& op->bone
+				)
 				{
-					vtotal = Ovtotal;
+					struct boneUdata *bUdat;
+					Gfx gfx;
+					int limb;
+					unsigned mtxaddr;
 					
-					if (!binflush())
-						return 0;
+					if (!(bUdat = op->bone->udata))
+						return errmsg("bone '%s' unprocessed", op->bone->name);
 					
-					/* retry this triangle next iteration */
-					f--;
+					limb = bUdat->matrixIndex;
+					mtxaddr = op->bone->skeleton->segment;
+					mtxaddr += 0x40 * limb;
+					gfx = gUcode->matrix(mtxaddr, true);
+					vfput32(bin, gfx.hi);
+					vfput32(bin, gfx.lo);
+					objexUdata->limbs.matrices += 1;
+					prevLimb = -1; /* just in case stacked DE's */
 				}
-			}
-			if (f > fStart)
-			{
-				if (!binflush())
+				
+				/* write material (or branch) */
+				if (!zobj_writeUsemtl(bin, op->mtl))
 					return 0;
+				continue;
 			}
-			return g;
-		} /* oneGroup */
-		
-		if (pass == 2)
-		{
-			unsigned int posMtxAddr = 0;
 			
-			/* has POSMTX attrib */
-			if (g->attrib && strstr(g->attrib, "POSMTX"))
+			/* step through runs of vertices sharing a subgroup,
+			 * performing material/matrix state changes where necessary
+			 */
+			/* TODO FIXME bone comparison */
+			for (int i = 0, n; i < b->vNum; i += n)
 			{
-				posMtxAddr = vftell(bin) + baseOfs;
-				if (!posMtx(bin, g->origin.x, g->origin.y, g->origin.z))
+				n = dlBatch_loadLen(b, i);
+				
+				/* write the run's state */
+				if (!state_change(&b->vbuf[i]))
 					return 0;
+				
+				/* and load it */
+				if (!loadRun(b, i, n))
+					return 0;
+				
+				for (int k = 0; k < n && b->slot; ++k)
+				{
+					sim[b->slotOf[i] + k] = b->vbuf[i + k];
+					simLive |= 1ull << (b->slotOf[i] + k);
+				}
 			}
 			
-			/* print docs */
-			// fprintf(docs, DOCS_DEF "DL_" DOCS_SPACE "   0x%08X\n"
-			// 	, Canitize(g->name, 1)
-			// 	, (int)vftell(bin) + baseOfs
-			// );
-			document_assign(
-				g->name,
-				NULL,
-				(int)vftell(bin) + baseOfs,
-				T_DL
-			);
-			debugf(" > '%s' address %08X\n", g->name, (int)vftell(bin) + baseOfs);
-			
-			/* has attributes */
-			if (g->attrib)
+			/* check the plan against what the commands loaded */
+			for (int i = 0; i < b->triNum && b->slot; ++i)
 			{
-				/* world positioning matrix (must precede bbmtx)
-				 * (ex: search 01000040 in Z2_TOWN_room_00.zmap) */
-				if (strstr(g->attrib, "POSMTX"))
-					vfput64s(bin, 0xDA380003, posMtxAddr);
-				/* explicit limb billboard */
-				if (strstr(g->attrib, "LIMBMTX"))
+				for (int k = 0; k < 3; ++k)
 				{
-					if (matrixBone < 0)
+					int s = b->tri[i][k];
+					
+					if (!((simLive >> s) & 1) || !compvert_equals(&sim[s], &b->slot[s]))
 						return errmsg(
-							"group '%s' incompatible with attrib LIMBMTX;"
-							" is it a Pbody?"
+							"group '%s' vertex buffer simulation mismatch"
 							, g->name
 						);
-					vfput64s(
-						bin
-						, 0xDA380003
-						, g->bone->skeleton->segment + 0x40 * matrixBone
-					);
 				}
-				/* explicit spherical billboard */
-				if (strstr(g->attrib, "BBMTXS"))
-					vfput64s(bin, 0xDA380001, 0x01000000);
-				/* explicit cylindrical billboard */
-				if (strstr(g->attrib, "BBMTXC"))
-					vfput64s(bin, 0xDA380001, 0x01000040);
 			}
+			
+			writeFaces(b);
 		}
 		
-		/* is not a Pbody, so we can write it this way */
-		if (!isPbody)
+		return success;
+	}
+	
+	/* two passes:
+	 * pass 1: write vertex buffers
+	 * pass 2: write display list
+	 */
+
+	for (int pass = passStart; pass <= passEnd; ++pass)
+	{
+		if (!(pass == 1 ? writeVertices() : writeCommands()))
 		{
-			if (!oneGroup(g))
-				return 0;
-			continue;
-		}
-		
-		/* is a Pbody, so we recombine all skeleton groups */
-		void *oneBone(struct objex_bone *b) {
-			if (b->g && !oneGroup(b->g)) return 0;
-			if (b->child && !oneBone(b->child)) return 0;
-			if (b->next && !oneBone(b->next)) return 0;
-			return b;
-		}
-		if (g->skeleton && !oneBone(g->skeleton->bone))
+			dlPlan_free(&plan);
 			return 0;
+		}
 	} /* passes */
+	gDlStateOn = false;
+	dlPlan_free(&plan);
 	
 	/* generic display list written */
 	if (forcePass == 0)/* end display list */{
@@ -1978,6 +4954,14 @@ void *zobj_writeDlist(
 		gSPEndDisplayList(p++);
 		vfput32(bin, gfx.hi);
 		vfput32(bin, gfx.lo);
+		
+		/* drop what changes nothing */
+		if (peephole && !dlist_peephole(bin, objex, dlStart))
+			return 0;
+		
+		/* use the same display list if already written */
+		if (poolDlists && !dlPool_put(bin, g, vbufStart, gUdata->dlistOffset, dlStart))
+			return 0;
 	}
 	
 	/* proxy feature */
@@ -3041,6 +6025,250 @@ void *zobj_doRelocs(VFILE *bin, struct objex *objex)
 #undef LOCALDIE
 }
 
+/* display lists the game itself nests before calling into an object's
+ * (the work buffer, then the opaque or translucent buffer)
+ */
+#define DLFLAT_GAME_DEPTH 2
+
+/* links a branch chain is followed before giving up, like on cycles */
+#define DLFLAT_CHAIN_MAX 64
+
+/* what --flatten-branches knows about each 8-byte slot of the file */
+struct dlFlatten
+{
+	uint8_t *data;
+	uint32_t end;
+	uint32_t baseOfs;
+	uint32_t *to;      /* where a call to here may go instead, 0 = unknown */
+	int8_t *depth;     /* calls nested below here, -1 = unknown, -2 = busy */
+	uint32_t *work;    /* display lists yet to walk */
+	int workNum;
+	uint8_t *walked;
+};
+
+/* file offset of a display list address, or -1 if not in this file */
+static int32_t dlFlatten_ofs(struct dlFlatten *fl, uint32_t addr)
+{
+	uint32_t ofs = addr - fl->baseOfs;
+	
+	if (addr < fl->baseOfs || ofs + 8 > fl->end || (ofs & 7))
+		return -1;
+	
+	return ofs;
+}
+
+/* follow branches, and calls followed by an end, from the start of a
+ * display list to the one that does the work; every link of the chain
+ * is remembered, so no chain is followed twice
+ */
+static uint32_t dlFlatten_resolve(struct dlFlatten *fl, uint32_t addr)
+{
+	uint32_t chain[DLFLAT_CHAIN_MAX];
+	int num = 0;
+	int32_t ofs;
+	
+	while ((ofs = dlFlatten_ofs(fl, addr)) >= 0 && num < DLFLAT_CHAIN_MAX)
+	{
+		uint8_t *cmd = fl->data + ofs;
+		uint32_t hi = get32(cmd);
+		
+		if (fl->to[ofs / 8])
+		{
+			addr = fl->to[ofs / 8];
+			break;
+		}
+		
+		/* DE xx 01 marks a proxy, which stays where it is */
+		if ((hi >> 24) != G_DL || (hi & 0x0000ff00))
+			break;
+		
+		/* a call that returns only to end is as good as a branch */
+		if (!(hi & 0x00ff0000)
+			&& (ofs + 16 > fl->end || (get32(cmd + 8) >> 24) != G_ENDDL)
+		)
+			break;
+		
+		chain[num++] = ofs;
+		addr = get32(cmd + 4);
+	}
+	
+	while (num--)
+		fl->to[chain[num] / 8] = addr;
+	
+	return addr;
+}
+
+static void dlFlatten_push(struct dlFlatten *fl, uint32_t addr)
+{
+	int32_t ofs = dlFlatten_ofs(fl, addr);
+	
+	if (ofs < 0 || fl->walked[ofs / 8])
+		return;
+	
+	fl->walked[ofs / 8] = 1;
+	fl->work[fl->workNum++] = ofs;
+}
+
+/* point every call and branch in a display list at the end of its
+ * chain, and write calls that are followed by an end as branches
+ */
+static void dlFlatten_walk(struct dlFlatten *fl, struct objexUdata *udata, uint32_t ofs)
+{
+	for (; ofs + 8 <= fl->end; ofs += 8)
+	{
+		uint8_t *cmd = fl->data + ofs;
+		uint32_t hi = get32(cmd);
+		uint32_t lo = get32(cmd + 4);
+		uint32_t to;
+		
+		if ((hi >> 24) == G_ENDDL)
+			return;
+		
+		if ((hi >> 24) != G_DL)
+			continue;
+		
+		if ((to = dlFlatten_resolve(fl, lo)) != lo)
+		{
+			put32(cmd + 4, to);
+			udata->branches.resolved += 1;
+		}
+		
+		if (!(hi & 0x00ff0000)
+			&& ofs + 16 <= fl->end
+			&& (get32(cmd + 8) >> 24) == G_ENDDL
+		)
+		{
+			hi |= 0x00010000;
+			put32(cmd, hi);
+			udata->branches.tailCalls += 1;
+		}
+		
+		/* what was called may be entered elsewhere, too */
+		dlFlatten_push(fl, lo);
+		dlFlatten_push(fl, to);
+		
+		/* a branch doesn't return */
+		if (hi & 0x00ff0000)
+			return;
+	}
+}
+
+/* calls nested below a display list; those into other files or
+ * segments count as one, and cycles as none
+ */
+static int dlFlatten_depth(struct dlFlatten *fl, uint32_t addr)
+{
+	int32_t ofs = dlFlatten_ofs(fl, addr);
+	int deepest = 0;
+	
+	if (ofs < 0)
+		return 0;
+	if (fl->depth[ofs / 8] == -2)
+		return 0;
+	if (fl->depth[ofs / 8] >= 0)
+		return fl->depth[ofs / 8];
+	
+	fl->depth[ofs / 8] = -2;
+	for (uint32_t at = ofs; at + 8 <= fl->end; at += 8)
+	{
+		uint32_t hi = get32(fl->data + at);
+		int d;
+		
+		if ((hi >> 24) == G_ENDDL)
+			break;
+		
+		if ((hi >> 24) != G_DL)
+			continue;
+		
+		d = dlFlatten_depth(fl, get32(fl->data + at + 4));
+		
+		/* a branch takes the place of this list on the stack */
+		if (!(hi & 0x00ff0000))
+			d += 1;
+		if (d > deepest)
+			deepest = d;
+		if (hi & 0x00ff0000)
+			break;
+	}
+	
+	fl->depth[ofs / 8] = deepest < INT8_MAX ? deepest : INT8_MAX;
+	return fl->depth[ofs / 8];
+}
+
+/* --flatten-branches: once relocations are done, walk every display
+ * list reachable from the groups written, resolving branch chains and
+ * turning trailing calls into branches; fails if any still nests
+ * deeper than the microcode's display list stack
+ */
+void *zobj_flattenBranches(VFILE *bin, struct objex *objex)
+{
+	struct objexUdata *udata = objex->udata;
+	struct dlFlatten fl = {0};
+	int slots;
+	
+	if (!udata)
+		return success;
+	
+	fl.data = bin->data;
+	fl.end = bin->end;
+	fl.baseOfs = udata->baseOfs;
+	slots = fl.end / 8 + 1;
+	
+	fl.to = calloc(slots, sizeof(*fl.to));
+	fl.depth = malloc(slots * sizeof(*fl.depth));
+	fl.work = malloc(slots * sizeof(*fl.work));
+	fl.walked = calloc(slots, sizeof(*fl.walked));
+	if (!fl.to || !fl.depth || !fl.work || !fl.walked)
+	{
+		free(fl.to);
+		free(fl.depth);
+		free(fl.work);
+		free(fl.walked);
+		return errmsg(ERR_NOMEM);
+	}
+	memset(fl.depth, -1, slots * sizeof(*fl.depth));
+	
+	for (struct objex_g *g = objex->g; g; g = g->next)
+		if (zobj_g_written(g) && g->udata)
+			dlFlatten_push(&fl, ((struct groupUdata*)g->udata)->dlistOffset + fl.baseOfs);
+	
+	while (fl.workNum)
+		dlFlatten_walk(&fl, udata, fl.work[--fl.workNum]);
+	
+	udata->branches.stackMax = gUcode->dlStackMax - DLFLAT_GAME_DEPTH;
+	for (struct objex_g *g = objex->g; g; g = g->next)
+	{
+		int d;
+		
+		if (!zobj_g_written(g) || !g->udata)
+			continue;
+		
+		/* the call into the group is one more */
+		d = dlFlatten_depth(&fl, ((struct groupUdata*)g->udata)->dlistOffset + fl.baseOfs) + 1;
+		if (d > udata->branches.deepest)
+			udata->branches.deepest = d;
+		
+		if (d > udata->branches.stackMax)
+		{
+			free(fl.to);
+			free(fl.depth);
+			free(fl.work);
+			free(fl.walked);
+			return errmsg(
+				"group '%s' nests display lists %d deep, but %s leaves"
+				" objects %d"
+				, g->name, d, gUcode->name, udata->branches.stackMax
+			);
+		}
+	}
+	
+	free(fl.to);
+	free(fl.depth);
+	free(fl.work);
+	free(fl.walked);
+	return success;
+}
+
 const char *zobj_errmsg(void)
 {
 	return error_reason;
@@ -7,6 +7,49 @@
 #include "objex.h"
 #include "vfile.h"
 
+/* vertex records written to a file, so identical runs of them can
+ * be loaded from one place (--pool-vertices)
+ */
+struct vtxPool
+{
+	uint8_t (*rec)[16]; /* every record written, in order written */
+	uint32_t *ofs;      /* file offset of each record */
+	int *next;          /* next older record with the same hash */
+	int *head;          /* newest record for each hash */
+	int num;
+	int max;
+	unsigned bytesShared; /* bytes not written because of the pool */
+	unsigned bytesWritten;
+	int extraLoads; /* gSPVertex split to share part of a load */
+};
+
+/* a group's vertex data and display list (--pool-dlists) */
+struct dlPoolBlock
+{
+	uint32_t start; /* vertex data, where the block starts */
+	uint32_t dl;    /* display list */
+	uint32_t cmd;   /* its first command, past any POSMTX matrix */
+	uint32_t end;
+	unsigned hash;
+};
+
+/* display lists written so far (--pool-dlists) */
+struct dlPool
+{
+	struct dlPoolBlock *block;
+	int num;
+	int max;
+	int shared; /* display lists not written because of the pool */
+	unsigned bytesShared;
+};
+
+/* one gSPVertex's worth of a pooled vertex load */
+struct vtxLoad
+{
+	uint32_t ofs;
+	int num;
+};
+
 struct objexUdata
 {
 	objex_udata_free  free;
@@ -23,6 +66,56 @@ struct objexUdata
 		unsigned start;
 		unsigned end;
 	} earlyPool;
+	
+	/* vertex records written so far (--pool-vertices) */
+	struct vtxPool *vtxPool;
+	
+	/* display lists written so far (--pool-dlists) */
+	struct dlPool *dlPool;
+	
+	/* materials left standalone or not (--auto-standalone) */
+	struct {
+		int called;
+		int inlined;
+		int bytesSaved; /* over calling every material */
+	} standalone;
+	
+	/* display list commands dropped (--peephole) */
+	struct {
+		int removed;  /* changed nothing */
+		int merged;   /* geometry mode folded into the one before */
+		int calls;    /* material calls among the removed */
+	} peephole;
+	
+	/* material switching costs (--order-materials) */
+	struct {
+		int groups;      /* reordered */
+		unsigned before; /* estimated rdp cycles */
+		unsigned after;
+	} drawOrder;
+	
+	/* skinned vertex batches (--batch-limbs) */
+	struct {
+		int groups;   /* faces reordered */
+		int matrices; /* matrix loads written */
+	} limbs;
+	
+	/* material calls reduced to what changes (--delta-materials) */
+	struct {
+		int calls;    /* to materials already written */
+		int omitted;  /* changed nothing */
+		int inlined;  /* changed one thing, written in place */
+		int skipped;  /* commands called past */
+		int dropped;  /* inline material commands that changed nothing */
+	} delta;
+	
+	/* branch chains resolved (--flatten-branches) */
+	struct {
+		int resolved;  /* calls and branches pointed further along */
+		int tailCalls; /* calls followed by an end made branches */
+		int deepest;   /* display lists nested, counting the group's */
+		int stackMax;  /* what the microcode leaves objects */
+	} branches;
 };
 
 struct boneUdata
@@ -47,6 +140,12 @@ struct groupUdata
 	uint32_t dlistOffset; /* offset of display list in file */
 	int hasWritten; /* has been written to file */
 	int isPbody;
+	int isReordered; /* faces reordered for the vertex buffer */
+	int isOrdered;   /* material runs ordered (--order-materials) */
+	int isLimbOrdered; /* faces grouped by limb (--batch-limbs) */
+	struct vtxLoad *vtxLoad; /* where pass 1 put each vertex load */
+	int vtxLoadNum;
+	int vtxLoadMax;
 };
 
 struct skUdata
@@ -120,5 +219,8 @@ extern int zobj_g_written(struct objex_g *g);
 extern void *zobj_doPlayAsData(VFILE *bin, struct objex *objex);
 extern void *zobj_doIdentityMatrices(VFILE *bin, struct objex *objex);
 extern void *zobj_writeUsemtl(VFILE *bin, struct objex_material *mtl);
+extern void *zobj_chooseStandalone(struct objex *objex, int isMesh(struct objex_g *g));
+extern void *zobj_flattenBranches(VFILE *bin, struct objex *objex);
+extern void zobj_printDlistStats(FILE *docs, struct objex *objex);
 #endif /* ZOBJ_H_INCLUDED */
 